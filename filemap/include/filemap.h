@@ -0,0 +1,98 @@
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2024 Yonder
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __FILEMAP_H__
+#define __FILEMAP_H__
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// Map the file at `path` read-only, NULL on failure or for empty files
+static inline uint8_t *FileMap_Open(const char *path, size_t *mapSz) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+    
+    LARGE_INTEGER fileSz;
+    if (!GetFileSizeEx(file, &fileSz) || fileSz.QuadPart <= 0 || (uint64_t) fileSz.QuadPart > SIZE_MAX) {
+        CloseHandle(file);
+        return NULL;
+    }
+    
+    // The view keeps the mapping and the file open until it is unmapped
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!mapping)
+        return NULL;
+    uint8_t *map = (uint8_t *) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!map)
+        return NULL;
+    
+    *mapSz = (size_t) fileSz.QuadPart;
+    return map;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size <= 0 || (uint64_t) st.st_size > SIZE_MAX) {
+        close(fd);
+        return NULL;
+    }
+    
+    // The mapping keeps the file open until it is unmapped
+    void *map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+    
+    // Everything mapped is about to be read, start paging it in
+    posix_madvise(map, (size_t) st.st_size, POSIX_MADV_WILLNEED);
+    *mapSz = (size_t) st.st_size;
+    return (uint8_t *) map;
+#endif
+}
+
+// Unmap a file mapped by FileMap_Open
+static inline void FileMap_Close(uint8_t *map, size_t mapSz) {
+#ifdef _WIN32
+    (void) mapSz;
+    UnmapViewOfFile(map);
+#else
+    munmap(map, mapSz);
+#endif
+}
+#endif
@@ -33,6 +33,7 @@
 #include <stdext/cdata.h>
 #include <stdext/cmath.h>
 #include <squish.h>
+#include <octree_color_quantizer.h>
 
 // GX texture data transcoding library
 // Based off the work and info from:
@@ -351,11 +352,48 @@ typedef enum GXDitherType {
     GX_DT_INVALID = GX_DT_MAX + 1
 } GXDitherType_t;
 
+typedef enum GXQuantizerType {
+    GX_QT_MIN = 0,
+    GX_QT_OCTREE = GX_QT_MIN,
+    GX_QT_MEDIAN_CUT,
+    GX_QT_MAX = GX_QT_MEDIAN_CUT,
+    GX_QT_INVALID = GX_QT_MAX + 1
+} GXQuantizerType_t;
+
+typedef enum GXPaletteFormat {
+    GX_PF_MIN = 0,
+    GX_PF_RGBA8 = GX_PF_MIN,
+    GX_PF_IA8,
+    GX_PF_R5G6B5,
+    GX_PF_RGB5A3,
+    GX_PF_MAX = GX_PF_RGB5A3,
+    GX_PF_INVALID = GX_PF_MAX + 1
+} GXPaletteFormat_t;
+
 typedef struct GXEncodeOptions {
     bool flipX;
     bool flipY;
     GXAvgType_t avgType;
     GXDitherType_t ditherType;
+    GXQuantizerType_t quantType;
+    // Format the palette will be encoded to, so that palettes are only built over what it can store
+    GXPaletteFormat_t palFmt;
+    // Maximum pixels to build the palette from, sampled evenly over the image, 0 to use every pixel
+    size_t sampleBudget;
+    // Most leaves the octree holds while building, reducing as it goes to bound memory, 0 for no limit
+    size_t octreeLeafCap;
+    // Levels the octree splits colors over, fewer is faster but coarser, 0 for the full depth
+    uint8_t octreeDepth;
+    // Octree to build palettes with, reset before each palette and freed by the caller, NULL to make one per palette
+    OCQOctreeQuantizer_t *octree;
+    // Counters the octree adds its work to, NULL for none
+    OCQStats_t *octreeStats;
+    // Maximum k-means refinement iterations over the palette, 0 disables refinement
+    uint32_t kmeansIters;
+    // Stop refining once no palette entry moves further than this distance
+    double kmeansThreshold;
+    // Stop refining after this many seconds of processor time, 0 for no limit
+    double kmeansTimeLimit;
     int squishFlags;
     size_t squishMetricSz;
     float *squishMetric;
@@ -26,11 +26,23 @@
 
 #include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
 #include <limits.h>
+#include <float.h>
+#include <time.h>
 
 #include <stdext/catexit.h>
 #include <octree_color_quantizer.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GX_SSE2
+#include <emmintrin.h>
+#endif
+
+// Fewest samples per band, and most bands, to build octrees over in parallel when building palettes
+#define GX_OCTREE_BAND_MIN_SZ 65536
+#define GX_OCTREE_BAND_MAX 8
+
 #ifndef bswap_dxt18
 #define bswap_dxt18(x) ((((x) & 0x3) << 6) | (((x) & 0xC) << 2) | (((x) & 0xC0) >> 6) | (((x) & 0x30) >> 2))
 #endif
@@ -1152,42 +1164,907 @@ static double *kernd[9] = {
     }
 };
 
+// Open addressing color -> value map (used as an unique color histogram and as a nearest palette index cache)
+typedef struct GXClrMap {
+    size_t cap;
+    size_t len;
+    uint32_t *clrs;
+    uint32_t *vals;
+    uint8_t *used;
+} GXClrMap_t;
+
+typedef struct GXClrCount {
+    uint32_t clr;
+    uint32_t cnt;
+} GXClrCount_t;
+
+typedef struct GXMedianCutBox {
+    size_t start;
+    size_t end;
+    uint64_t cnt;
+    uint8_t min[4];
+    uint8_t max[4];
+} GXMedianCutBox_t;
+
+static const uint8_t clrsh[4] = { GX_COMP_SH_B, GX_COMP_SH_G, GX_COMP_SH_R, GX_COMP_SH_A };
+
+FORCE_INLINE size_t ClrMap_Hash(uint32_t clr, size_t cap) {
+    return (size_t) ((clr * UINT32_C(0x9E3779B1)) ^ (clr >> 16)) & (cap - 1);
+}
+
+static bool ClrMap_Init(GXClrMap_t *map, size_t cap) {
+    size_t aCap = 64;
+    while (aCap < cap)
+        aCap <<= 1;
+    
+    map->cap = aCap;
+    map->len = 0;
+    map->clrs = malloc(aCap * sizeof(uint32_t));
+    map->vals = malloc(aCap * sizeof(uint32_t));
+    map->used = calloc(aCap, sizeof(uint8_t));
+    if (!map->clrs || !map->vals || !map->used) {
+        free(map->clrs);
+        free(map->vals);
+        free(map->used);
+        map->clrs = NULL;
+        map->vals = NULL;
+        map->used = NULL;
+        map->cap = 0;
+        return true;
+    }
+    return false;
+}
+
+static void ClrMap_Free(GXClrMap_t *map) {
+    free(map->clrs);
+    map->clrs = NULL;
+    free(map->vals);
+    map->vals = NULL;
+    free(map->used);
+    map->used = NULL;
+    map->cap = 0;
+    map->len = 0;
+}
+
+// Get the slot of `clr`, or the empty slot it would be inserted in
+FORCE_INLINE size_t ClrMap_Slot(GXClrMap_t *map, uint32_t clr) {
+    size_t i = ClrMap_Hash(clr, map->cap);
+    while (map->used[i] && map->clrs[i] != clr)
+        i = (i + 1) & (map->cap - 1);
+    return i;
+}
+
+static bool ClrMap_Grow(GXClrMap_t *map) {
+    GXClrMap_t newMap;
+    if (ClrMap_Init(&newMap, map->cap * 2))
+        return true;
+    
+    for (size_t i = 0; i < map->cap; i++) {
+        if (map->used[i]) {
+            size_t j = ClrMap_Slot(&newMap, map->clrs[i]);
+            newMap.used[j] = 1;
+            newMap.clrs[j] = map->clrs[i];
+            newMap.vals[j] = map->vals[i];
+            newMap.len++;
+        }
+    }
+    ClrMap_Free(map);
+    *map = newMap;
+    return false;
+}
+
+// Get the value slot of `clr`, inserting it with a value of 0 if it is not present
+// Returns NULL on allocation failure
+static uint32_t *ClrMap_Put(GXClrMap_t *map, uint32_t clr) {
+    size_t i = ClrMap_Slot(map, clr);
+    if (map->used[i])
+        return &map->vals[i];
+    
+    // Keep the load factor at or below 1/2
+    if ((map->len + 1) * 2 > map->cap) {
+        if (ClrMap_Grow(map))
+            return NULL;
+        i = ClrMap_Slot(map, clr);
+    }
+    map->used[i] = 1;
+    map->clrs[i] = clr;
+    map->vals[i] = 0;
+    map->len++;
+    return &map->vals[i];
+}
+
+// Get the unique colors and their counts from a histogram map
+static GXClrCount_t *ClrMap_ToCounts(GXClrMap_t *map) {
+    GXClrCount_t *ents = malloc((map->len ? map->len : 1) * sizeof(GXClrCount_t));
+    if (!ents)
+        return NULL;
+    
+    size_t n = 0;
+    for (size_t i = 0; i < map->cap; i++) {
+        if (map->used[i]) {
+            ents[n].clr = map->clrs[i];
+            ents[n].cnt = map->vals[i];
+            n++;
+        }
+    }
+    return ents;
+}
+
+// Reduce `clr` to the precision `palFmt` stores it at, as it would decode again
+FORCE_INLINE uint32_t Clr_Reduce(uint32_t clr, GXPaletteFormat_t palFmt) {
+    uint32_t b = (clr >> GX_COMP_SH_B) & 0xFF;
+    uint32_t g = (clr >> GX_COMP_SH_G) & 0xFF;
+    uint32_t r = (clr >> GX_COMP_SH_R) & 0xFF;
+    uint32_t a = (clr >> GX_COMP_SH_A) & 0xFF;
+    switch (palFmt) {
+        case GX_PF_R5G6B5:
+            b = Dat_Convert5To8(b >> 3);
+            g = Dat_Convert6To8(g >> 2);
+            r = Dat_Convert5To8(r >> 3);
+            a = 0xFF;
+            break;
+        case GX_PF_RGB5A3:
+            if ((a >> 5) >= 7) {
+                b = Dat_Convert5To8(b >> 3);
+                g = Dat_Convert5To8(g >> 3);
+                r = Dat_Convert5To8(r >> 3);
+                a = 0xFF;
+            } else {
+                b = Dat_Convert4To8(b >> 4);
+                g = Dat_Convert4To8(g >> 4);
+                r = Dat_Convert4To8(r >> 4);
+                a = Dat_Convert3To8(a >> 5);
+            }
+            break;
+        default:
+            return clr;
+    }
+    
+    return (b << GX_COMP_SH_B) | (g << GX_COMP_SH_G) | (r << GX_COMP_SH_R) | (a << GX_COMP_SH_A);
+}
+
+// Palette the image losslessly when it has no more unique colors than `palSz`, mapping every pixel through the hash
+// Sets `*fits` to false as soon as the count exceeds `palSz`, leaving `pal` and `outIdx` partially written
+static bool Exact_MakePalette(size_t inSz, uint32_t *in, size_t palSz, uint32_t *pal, uint32_t *outIdx,
+size_t *paletteSz, bool *fits) {
+    *paletteSz = 0;
+    *fits = false;
+    
+    // Sized so that it never needs to grow before the count runs over
+    GXClrMap_t map;
+    if (ClrMap_Init(&map, (palSz + 1) * 2))
+        return true;
+    
+    for (size_t i = 0; catexit_loopSafety && i < inSz; i++) {
+        size_t slot = ClrMap_Slot(&map, in[i]);
+        if (!map.used[slot]) {
+            if (map.len == palSz) {
+                ClrMap_Free(&map);
+                return false;
+            }
+            map.used[slot] = 1;
+            map.clrs[slot] = in[i];
+            map.vals[slot] = (uint32_t) map.len;
+            pal[map.len++] = in[i];
+        }
+        outIdx[i] = map.vals[slot];
+    }
+    
+    *paletteSz = map.len;
+    *fits = true;
+    ClrMap_Free(&map);
+    return false;
+}
+
+static void MedianCut_Bound(GXClrCount_t *ents, GXMedianCutBox_t *box) {
+    box->cnt = 0;
+    for (size_t c = 0; c < 4; c++) {
+        box->min[c] = 0xFF;
+        box->max[c] = 0x00;
+    }
+    
+    for (size_t i = box->start; i < box->end; i++) {
+        box->cnt += ents[i].cnt;
+        for (size_t c = 0; c < 4; c++) {
+            uint8_t v = (ents[i].clr >> clrsh[c]) & 0xFF;
+            if (v < box->min[c])
+                box->min[c] = v;
+            if (v > box->max[c])
+                box->max[c] = v;
+        }
+    }
+}
+
+FORCE_INLINE size_t MedianCut_WidestChannel(GXMedianCutBox_t *box) {
+    size_t widest = 0;
+    for (size_t c = 1; c < 4; c++)
+        if (box->max[c] - box->min[c] > box->max[widest] - box->min[widest])
+            widest = c;
+    return widest;
+}
+
+// Partition the box along channel `c` around its weighted median without fully sorting it (nth_element style)
+// Returns the split point, which always leaves both halves non-empty
+static size_t MedianCut_Split(GXClrCount_t *ents, GXMedianCutBox_t *box, size_t c) {
+    uint32_t sh = clrsh[c];
+    uint64_t half = box->cnt / 2;
+    uint64_t leftCnt = 0;
+    size_t lo = box->start;
+    size_t hi = box->end;
+    size_t split = box->start;
+    while (catexit_loopSafety && lo < hi) {
+        uint32_t pivot = (ents[lo + (hi - lo) / 2].clr >> sh) & 0xFF;
+        
+        // Three way partition of [lo, hi) into < pivot, == pivot, > pivot
+        size_t lt = lo, i = lo, gt = hi;
+        uint64_t ltCnt = 0, eqCnt = 0;
+        while (i < gt) {
+            uint32_t v = (ents[i].clr >> sh) & 0xFF;
+            if (v < pivot) {
+                GXClrCount_t t = ents[lt];
+                ents[lt++] = ents[i];
+                ents[i++] = t;
+                ltCnt += ents[lt - 1].cnt;
+            } else if (v > pivot) {
+                GXClrCount_t t = ents[--gt];
+                ents[gt] = ents[i];
+                ents[i] = t;
+            } else {
+                eqCnt += ents[i].cnt;
+                i++;
+            }
+        }
+        
+        if (leftCnt + ltCnt > half)
+            hi = lt;
+        else if (leftCnt + ltCnt + eqCnt >= half) {
+            // Median lies within the pivot run, cut on whichever side of it is closer without emptying a half
+            bool ltOk = lt > box->start;
+            bool gtOk = gt < box->end;
+            uint64_t ltDist = half - (leftCnt + ltCnt);
+            uint64_t gtDist = (leftCnt + ltCnt + eqCnt) - half;
+            split = (ltOk && (!gtOk || ltDist <= gtDist)) ? lt : gt;
+            break;
+        } else {
+            leftCnt += ltCnt + eqCnt;
+            lo = gt;
+        }
+    }
+    
+    if (split <= box->start)
+        split = box->start + 1;
+    if (split >= box->end)
+        split = box->end - 1;
+    return split;
+}
+
+// Quantize the unique colors of `ents` to at most `palSz` colors by median cut
+static size_t MedianCut_MakePalette(size_t entsSz, GXClrCount_t *ents, size_t palSz, uint32_t *pal) {
+    if (!entsSz || !palSz)
+        return 0;
+    
+    GXMedianCutBox_t *boxes = malloc(palSz * sizeof(GXMedianCutBox_t));
+    if (!boxes)
+        return 0;
+    
+    size_t boxesSz = 1;
+    boxes[0].start = 0;
+    boxes[0].end = entsSz;
+    MedianCut_Bound(ents, &boxes[0]);
+    while (catexit_loopSafety && boxesSz < palSz) {
+        // Cut the box with the largest population weighted extent first
+        size_t best = SIZE_MAX;
+        uint64_t bestScore = 0;
+        for (size_t b = 0; b < boxesSz; b++) {
+            if (boxes[b].end - boxes[b].start < 2)
+                continue;
+            size_t c = MedianCut_WidestChannel(&boxes[b]);
+            uint64_t score = (uint64_t) (boxes[b].max[c] - boxes[b].min[c]) * boxes[b].cnt;
+            if (best == SIZE_MAX || score > bestScore) {
+                best = b;
+                bestScore = score;
+            }
+        }
+        if (best == SIZE_MAX)
+            break;
+        
+        GXMedianCutBox_t *box = &boxes[best];
+        size_t split = MedianCut_Split(ents, box, MedianCut_WidestChannel(box));
+        GXMedianCutBox_t *newBox = &boxes[boxesSz++];
+        newBox->start = split;
+        newBox->end = box->end;
+        box->end = split;
+        MedianCut_Bound(ents, box);
+        MedianCut_Bound(ents, newBox);
+    }
+    
+    for (size_t b = 0; b < boxesSz; b++) {
+        uint64_t sum[4] = { 0, 0, 0, 0 };
+        for (size_t i = boxes[b].start; i < boxes[b].end; i++)
+            for (size_t c = 0; c < 4; c++)
+                sum[c] += (uint64_t) ((ents[i].clr >> clrsh[c]) & 0xFF) * ents[i].cnt;
+        
+        pal[b] = 0;
+        for (size_t c = 0; c < 4; c++)
+            pal[b] |= ((uint32_t) ((sum[c] + boxes[b].cnt / 2) / boxes[b].cnt)) << clrsh[c];
+    }
+    free(boxes);
+    
+    return catexit_loopSafety ? boxesSz : 0;
+}
+
+// Palette in structure of arrays form for the nearest color search, channels are stored in `clrsh` order and
+// padded up to a multiple of 4 entries
+typedef struct GXPalSoA {
+    size_t palSz;
+    size_t padSz;
+    float *chans;
+} GXPalSoA_t;
+
+FORCE_INLINE void Clr_ToFloats(uint32_t clr, float out[4]) {
+    for (size_t c = 0; c < 4; c++)
+        out[c] = (float) ((clr >> clrsh[c]) & 0xFF);
+}
+
+FORCE_INLINE uint32_t Clr_FromFloats(float in[4]) {
+    uint32_t clr = 0;
+    for (size_t c = 0; c < 4; c++)
+        clr |= ((uint32_t) Math_ClampDb(round(in[c]), 0, UCHAR_MAX)) << clrsh[c];
+    return clr;
+}
+
+FORCE_INLINE void PalSoA_Set(GXPalSoA_t *soa, size_t i, float clr[4]) {
+    for (size_t c = 0; c < 4; c++)
+        soa->chans[c * soa->padSz + i] = clr[c];
+}
+
+FORCE_INLINE void PalSoA_Get(GXPalSoA_t *soa, size_t i, float clr[4]) {
+    for (size_t c = 0; c < 4; c++)
+        clr[c] = soa->chans[c * soa->padSz + i];
+}
+
+static bool PalSoA_Init(GXPalSoA_t *soa, size_t palSz, uint32_t *pal) {
+    soa->palSz = palSz;
+    soa->padSz = (palSz + 3) & ~((size_t) 3);
+    soa->chans = malloc(soa->padSz * 4 * sizeof(float));
+    if (!soa->chans)
+        return true;
+    
+    for (size_t i = 0; i < soa->padSz; i++) {
+        // Padding is placed far enough away to never be the nearest, but close enough to not overflow
+        float clr[4] = { 1e9f, 1e9f, 1e9f, 1e9f };
+        if (i < palSz)
+            Clr_ToFloats(pal[i], clr);
+        PalSoA_Set(soa, i, clr);
+    }
+    return false;
+}
+
+static void PalSoA_Free(GXPalSoA_t *soa) {
+    free(soa->chans);
+    soa->chans = NULL;
+}
+
+// Index of the palette entry with the least squared distance to `clr`, the lowest index wins ties
+static size_t PalSoA_Nearest(GXPalSoA_t *soa, float clr[4]) {
+    float *ch0 = soa->chans;
+    float *ch1 = ch0 + soa->padSz;
+    float *ch2 = ch1 + soa->padSz;
+    float *ch3 = ch2 + soa->padSz;
+#ifdef GX_SSE2
+    // Evaluates 4 palette entries per step
+    __m128 c0 = _mm_set1_ps(clr[0]);
+    __m128 c1 = _mm_set1_ps(clr[1]);
+    __m128 c2 = _mm_set1_ps(clr[2]);
+    __m128 c3 = _mm_set1_ps(clr[3]);
+    __m128 bestDist = _mm_set1_ps(FLT_MAX);
+    __m128i bestIdx = _mm_setzero_si128();
+    __m128i idx = _mm_setr_epi32(0, 1, 2, 3);
+    __m128i idxStep = _mm_set1_epi32(4);
+    for (size_t i = 0; i < soa->padSz; i += 4) {
+        __m128 d0 = _mm_sub_ps(_mm_loadu_ps(ch0 + i), c0);
+        __m128 d1 = _mm_sub_ps(_mm_loadu_ps(ch1 + i), c1);
+        __m128 d2 = _mm_sub_ps(_mm_loadu_ps(ch2 + i), c2);
+        __m128 d3 = _mm_sub_ps(_mm_loadu_ps(ch3 + i), c3);
+        __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(d0, d0), _mm_mul_ps(d1, d1)),
+            _mm_add_ps(_mm_mul_ps(d2, d2), _mm_mul_ps(d3, d3)));
+        __m128i closer = _mm_castps_si128(_mm_cmplt_ps(dist, bestDist));
+        bestDist = _mm_min_ps(dist, bestDist);
+        bestIdx = _mm_or_si128(_mm_and_si128(closer, idx), _mm_andnot_si128(closer, bestIdx));
+        idx = _mm_add_epi32(idx, idxStep);
+    }
+    
+    float dists[4];
+    int32_t idxs[4];
+    _mm_storeu_ps(dists, bestDist);
+    _mm_storeu_si128((__m128i *) idxs, bestIdx);
+    size_t best = 0;
+    for (size_t l = 1; l < 4; l++)
+        if (dists[l] < dists[best] || (dists[l] == dists[best] && idxs[l] < idxs[best]))
+            best = l;
+    return (size_t) idxs[best];
+#else
+    size_t best = 0;
+    float bestDist = FLT_MAX;
+    for (size_t i = 0; i < soa->palSz; i++) {
+        float d0 = ch0[i] - clr[0];
+        float d1 = ch1[i] - clr[1];
+        float d2 = ch2[i] - clr[2];
+        float d3 = ch3[i] - clr[3];
+        float dist = (d0 * d0 + d1 * d1) + (d2 * d2 + d3 * d3);
+        if (dist < bestDist) {
+            bestDist = dist;
+            best = i;
+        }
+    }
+    return best;
+#endif
+}
+
+// Nearest palette index for `clr`, memoized through `cache`
+// Returns SIZE_MAX on allocation failure
+static size_t PalSoA_NearestCached(GXPalSoA_t *soa, GXClrMap_t *cache, uint32_t clr) {
+    uint32_t *val = ClrMap_Put(cache, clr);
+    if (!val)
+        return SIZE_MAX;
+    
+    // Values are stored as index + 1 so that 0 marks a fresh entry
+    if (!*val) {
+        float fclr[4];
+        Clr_ToFloats(clr, fclr);
+        *val = (uint32_t) PalSoA_Nearest(soa, fclr) + 1;
+    }
+    return *val - 1;
+}
+
+// Pick one pixel out of every cell of a grid laid over the image, at a hashed but deterministic position within the
+// cell, with the grid sized so that no more than `budget` pixels are picked
+static size_t Sample_Stratified(uint16_t w, uint16_t h, uint32_t *in, size_t budget, uint32_t *out) {
+    size_t step = (size_t) ceil(sqrt((double) w * h / budget));
+    if (!step)
+        step = 1;
+    while (((w + step - 1) / step) * ((h + step - 1) / step) > budget)
+        step++;
+    
+    size_t outSz = 0;
+    for (size_t cy = 0; catexit_loopSafety && cy < h; cy += step) {
+        for (size_t cx = 0; catexit_loopSafety && cx < w; cx += step) {
+            size_t cw = step < w - cx ? step : w - cx;
+            size_t ch = step < h - cy ? step : h - cy;
+            uint32_t hsh = (((uint32_t) cx * UINT32_C(73856093)) ^ ((uint32_t) cy * UINT32_C(19349663)))
+                * UINT32_C(0x9E3779B1);
+            size_t x = cx + ((hsh >> 4) % cw);
+            size_t y = cy + ((hsh >> 18) % ch);
+            out[outSz++] = in[y * w + x];
+        }
+    }
+    return outSz;
+}
+
+// Refine `pal` in place with bounded Lloyd (k-means) iterations over the unique colors of `ents`
+static bool KMeans_Refine(size_t entsSz, GXClrCount_t *ents, size_t palSz, uint32_t *pal, GXEncodeOptions_t *opts) {
+    GXPalSoA_t soa;
+    if (PalSoA_Init(&soa, palSz, pal))
+        return true;
+    
+    // 4 channel sums and a pixel count per cluster
+    uint64_t *sums = malloc(palSz * 5 * sizeof(uint64_t));
+    if (!sums) {
+        PalSoA_Free(&soa);
+        return true;
+    }
+    
+    clock_t start = clock();
+    for (uint32_t it = 0; catexit_loopSafety && it < opts->kmeansIters; it++) {
+        memset(sums, 0, palSz * 5 * sizeof(uint64_t));
+        for (size_t i = 0; i < entsSz; i++) {
+            float clr[4];
+            Clr_ToFloats(ents[i].clr, clr);
+            uint64_t *sum = sums + PalSoA_Nearest(&soa, clr) * 5;
+            for (size_t c = 0; c < 4; c++)
+                sum[c] += (uint64_t) clr[c] * ents[i].cnt;
+            sum[4] += ents[i].cnt;
+        }
+        
+        // Move every used cluster to its centroid, empty clusters keep their color
+        double maxMove = 0.0;
+        for (size_t k = 0; k < palSz; k++) {
+            uint64_t *sum = sums + k * 5;
+            if (!sum[4])
+                continue;
+            
+            float oldClr[4];
+            float newClr[4];
+            double move = 0.0;
+            PalSoA_Get(&soa, k, oldClr);
+            for (size_t c = 0; c < 4; c++) {
+                newClr[c] = (float) ((double) sum[c] / (double) sum[4]);
+                move += ((double) newClr[c] - oldClr[c]) * ((double) newClr[c] - oldClr[c]);
+            }
+            PalSoA_Set(&soa, k, newClr);
+            if (move > maxMove)
+                maxMove = move;
+        }
+        
+        if (sqrt(maxMove) <= opts->kmeansThreshold)
+            break;
+        
+        if (opts->kmeansTimeLimit > 0.0 && ((double) (clock() - start)) / CLOCKS_PER_SEC >= opts->kmeansTimeLimit)
+            break;
+    }
+    
+    for (size_t k = 0; k < palSz; k++) {
+        float clr[4];
+        PalSoA_Get(&soa, k, clr);
+        pal[k] = Clr_FromFloats(clr);
+    }
+    
+    free(sums);
+    PalSoA_Free(&soa);
+    return !catexit_loopSafety;
+}
+
+// Free `octree` unless it is the quantizer the caller passed in `opts` to reuse
+FORCE_INLINE void Octree_Release(OCQOctreeQuantizer_t *octree, GXEncodeOptions_t *opts) {
+    if (octree != opts->octree)
+        OCQOctreeQuantizer_free(octree);
+}
+
+// Build a palette of up to `palSz` entries from `in`, `*octree` is set when the palette was built by an octree that is
+// still valid for looking up colors
+static bool RGBA_MakePalette(uint16_t w, uint16_t h, size_t inSz, uint32_t *in, size_t palSz, uint32_t *pal,
+size_t *paletteSz, OCQOctreeQuantizer_t **octree, GXEncodeOptions_t *opts) {
+    *paletteSz = 0;
+    *octree = NULL;
+    
+    // Build the palette from a stratified subset of the pixels once over the sample budget, every pixel is still
+    // mapped to it afterwards
+    size_t smpSz = inSz;
+    uint32_t *smp = in;
+    if (opts->sampleBudget && opts->sampleBudget < inSz) {
+        smp = malloc(opts->sampleBudget * sizeof(uint32_t));
+        if (!smp)
+            return true;
+        smpSz = Sample_Stratified(w, h, in, opts->sampleBudget, smp);
+    }
+    
+    // Unique colors with their pixel counts, for the quantizers and passes that work on the histogram
+    size_t entsSz = 0;
+    GXClrCount_t *ents = NULL;
+    if (opts->quantType == GX_QT_MEDIAN_CUT || opts->kmeansIters) {
+        GXClrMap_t hist;
+        if (ClrMap_Init(&hist, 256)) {
+            if (smp != in)
+                free(smp);
+            return true;
+        }
+        
+        for (size_t i = 0; catexit_loopSafety && i < smpSz; i++) {
+            uint32_t *cnt = ClrMap_Put(&hist, smp[i]);
+            if (!cnt) {
+                ClrMap_Free(&hist);
+                if (smp != in)
+                    free(smp);
+                return true;
+            }
+            (*cnt)++;
+        }
+        
+        entsSz = hist.len;
+        ents = ClrMap_ToCounts(&hist);
+        ClrMap_Free(&hist);
+        if (!ents) {
+            if (smp != in)
+                free(smp);
+            return true;
+        }
+    }
+    
+    if (opts->quantType == GX_QT_MEDIAN_CUT)
+        // Quantize by median cut
+        *paletteSz = MedianCut_MakePalette(entsSz, ents, palSz, pal);
+    else {
+        // Quantize by octree, splitting colors on RGB bits only when every pixel is opaque
+        bool opaque = true;
+        for (size_t i = 0; catexit_loopSafety && opaque && i < inSz; i++)
+            opaque = ((in[i] >> GX_COMP_SH_A) & 0xFF) == 0xFF;
+        
+        OCQOctreeQuantizerOptions_t octreeOpts = {
+            .leaf_cap = opts->octreeLeafCap,
+            .rgb_only = opaque,
+            .max_depth = opts->octreeDepth,
+            .stats = opts->octreeStats
+        };
+        
+        // Build a tree per band of the samples and merge them in band order, bands only depend on the sample count
+        // so the tree comes out the same on any number of threads
+        size_t bandCnt = smpSz / GX_OCTREE_BAND_MIN_SZ;
+        bandCnt = bandCnt < 1 ? 1 : (bandCnt > GX_OCTREE_BAND_MAX ? GX_OCTREE_BAND_MAX : bandCnt);
+        OCQOctreeQuantizer_t *bands[GX_OCTREE_BAND_MAX] = { 0 };
+        // Bands after the first count into their own stats, added to the caller's once they are done
+        OCQStats_t bandStats[GX_OCTREE_BAND_MAX] = { 0 };
+#ifdef _OPENMP
+        #pragma omp parallel for schedule(static)
+#endif
+        for (int32_t b = 0; b < (int32_t) bandCnt; b++) {
+            size_t bandStart = (smpSz * b) / bandCnt;
+            size_t bandEnd = (smpSz * (b + 1)) / bandCnt;
+            OCQOctreeQuantizerOptions_t bandOpts = octreeOpts;
+            if (b && bandOpts.stats)
+                bandOpts.stats = &bandStats[b];
+            // The caller's quantizer takes the first band, keeping its storage from the last palette
+            if (b == 0 && opts->octree)
+                bands[b] = OCQOctreeQuantizer_reset(opts->octree, &bandOpts) ? opts->octree : NULL;
+            else
+                bands[b] = OCQOctreeQuantizer___init__(&bandOpts);
+            if (bands[b])
+                OCQOctreeQuantizer_add_colors_raw(bands[b], smp + bandStart, bandEnd - bandStart);
+        }
+        
+        bool bandFail = false;
+        for (size_t b = 0; b < bandCnt; b++)
+            bandFail |= !bands[b];
+        for (size_t b = 1; b < bandCnt; b++) {
+            if (!bandFail)
+                OCQOctreeQuantizer_merge(bands[0], bands[b]);
+            OCQOctreeQuantizer_free(bands[b]);
+            OCQStats_add(opts->octreeStats, &bandStats[b]);
+        }
+        *octree = bands[0];
+        if (bandFail) {
+            Octree_Release(*octree, opts);
+            *octree = NULL;
+            if (smp != in)
+                free(smp);
+            free(ents);
+            return true;
+        }
+        
+        OCQOctreeQuantizer_make_palette_raw(*octree, palSz, pal, paletteSz);
+    }
+    if (smp != in)
+        free(smp);
+    
+    // Refine by k-means
+    if (*paletteSz && opts->kmeansIters) {
+        if (KMeans_Refine(entsSz, ents, *paletteSz, pal, opts))
+            *paletteSz = 0;
+        
+        // The octree lookup no longer matches the moved palette entries
+        Octree_Release(*octree, opts);
+        *octree = NULL;
+    }
+    free(ents);
+    
+    if (!*paletteSz) {
+        Octree_Release(*octree, opts);
+        *octree = NULL;
+        return true;
+    }
+    return !catexit_loopSafety;
+}
+
+FORCE_INLINE uint32_t Clr_FromIA(uint8_t i, uint8_t a) {
+    return ((uint32_t) i << GX_COMP_SH_B) | ((uint32_t) i << GX_COMP_SH_G) | ((uint32_t) i << GX_COMP_SH_R)
+        | ((uint32_t) a << GX_COMP_SH_A);
+}
+
+// Key of a gray color in the IA8 histogram and lookup table
+FORCE_INLINE uint16_t IA8_Key(uint32_t clr) {
+    return (uint16_t) ((((clr >> GX_COMP_SH_A) & 0xFF) << 8) | ((clr >> GX_COMP_SH_R) & 0xFF));
+}
+
+// Build a palette of gray colors for IA8 palettes, quantizing only intensity and alpha since the rest is dropped on
+// encode, `in` must already be projected to gray
+static bool IA8_MakePalette(size_t inSz, uint32_t *in, size_t palSz, uint32_t *pal, size_t *paletteSz,
+GXEncodeOptions_t *opts) {
+    *paletteSz = 0;
+    
+    uint32_t *hist = calloc(0x10000, sizeof(uint32_t));
+    if (!hist)
+        return true;
+    
+    size_t entsSz = 0;
+    for (size_t i = 0; catexit_loopSafety && i < inSz; i++) {
+        if (!hist[IA8_Key(in[i])]++)
+            entsSz++;
+    }
+    
+    // Intensity goes in a single channel while quantizing, so that distances weigh intensity and alpha the same
+    GXClrCount_t *ents = malloc((entsSz ? entsSz : 1) * sizeof(GXClrCount_t));
+    if (!ents) {
+        free(hist);
+        return true;
+    }
+    
+    size_t n = 0;
+    for (uint32_t k = 0; k < 0x10000; k++) {
+        if (hist[k]) {
+            ents[n].clr = ((k & 0xFF) << GX_COMP_SH_R) | ((k >> 8) << GX_COMP_SH_A);
+            ents[n].cnt = hist[k];
+            n++;
+        }
+    }
+    free(hist);
+    
+    bool fail = false;
+    if (entsSz <= palSz) {
+        for (size_t i = 0; i < entsSz; i++)
+            pal[i] = ents[i].clr;
+        *paletteSz = entsSz;
+    } else {
+        *paletteSz = MedianCut_MakePalette(entsSz, ents, palSz, pal);
+        if (*paletteSz && opts->kmeansIters)
+            fail = KMeans_Refine(entsSz, ents, *paletteSz, pal, opts);
+    }
+    free(ents);
+    
+    for (size_t i = 0; i < *paletteSz; i++)
+        pal[i] = Clr_FromIA((pal[i] >> GX_COMP_SH_R) & 0xFF, (pal[i] >> GX_COMP_SH_A) & 0xFF);
+    
+    if (fail || !*paletteSz) {
+        *paletteSz = 0;
+        return true;
+    }
+    return !catexit_loopSafety;
+}
+
+// Get the index of the palette entry nearest to the gray color `clr`, caching it in the 64K entry `table`
+FORCE_INLINE size_t IA8_Nearest(size_t palSz, uint32_t *pal, uint16_t *table, uint32_t clr) {
+    uint16_t key = IA8_Key(clr);
+    if (table[key])
+        return table[key] - 1;
+    
+    int32_t i = (key & 0xFF);
+    int32_t a = (key >> 8);
+    size_t best = 0;
+    int32_t bestDist = INT32_MAX;
+    for (size_t p = 0; p < palSz; p++) {
+        int32_t di = i - (int32_t) ((pal[p] >> GX_COMP_SH_R) & 0xFF);
+        int32_t da = a - (int32_t) ((pal[p] >> GX_COMP_SH_A) & 0xFF);
+        int32_t dist = di * di + da * da;
+        if (dist < bestDist) {
+            bestDist = dist;
+            best = p;
+        }
+    }
+    table[key] = (uint16_t) (best + 1);
+    return best;
+}
+
 GX_EXPORT bool GX_BuildPalette(uint16_t w, uint16_t h, size_t inSz, uint32_t *in, size_t palSz, uint32_t *pal, size_t outIdxSz,
 uint32_t *outIdx, size_t *outPalSz, GXEncodeOptions_t *opts) {
     if (inSz != w * h || !in || (palSz != GX_GetMaxPalSz(GX_CI4_BPP) && palSz != GX_GetMaxPalSz(GX_CI8_BPP)
     && palSz != GX_GetMaxPalSz(GX_CI14X2_BPP)) || !pal || outIdxSz != inSz || !outIdx || !outPalSz || !opts
-    || opts->ditherType < GX_DT_MIN || opts->ditherType > GX_DT_MAX)
+    || opts->ditherType < GX_DT_MIN || opts->ditherType > GX_DT_MAX || opts->quantType < GX_QT_MIN
+    || opts->quantType > GX_QT_MAX || opts->palFmt < GX_PF_MIN || opts->palFmt > GX_PF_MAX
+    || opts->octreeDepth > OCQ_MAX_DEPTH || opts->kmeansThreshold < 0.0 || opts->kmeansTimeLimit < 0.0)
         return true;
     
     *outPalSz = 0;
     
+    bool isIA8 = opts->palFmt == GX_PF_IA8;
+    bool isReduced = opts->palFmt == GX_PF_R5G6B5 || opts->palFmt == GX_PF_RGB5A3;
+    
+    // Build the palette over colors at the precision the palette is stored at, distinctions below it are lost on
+    // encode anyway and only grow the set of unique colors
+    uint32_t *red = in;
+    if (isReduced) {
+        red = malloc(inSz * sizeof(uint32_t));
+        if (!red)
+            return true;
+        for (size_t i = 0; catexit_loopSafety && i < inSz; i++)
+            red[i] = Clr_Reduce(in[i], opts->palFmt);
+    }
+    
+    size_t paletteSz;
+    if (!isIA8) {
+        // Skip quantizing entirely when every color fits in the palette
+        bool fits;
+        if (Exact_MakePalette(inSz, red, palSz, pal, outIdx, &paletteSz, &fits)) {
+            if (red != in)
+                free(red);
+            return true;
+        }
+        if (fits) {
+            if (red != in)
+                free(red);
+            *outPalSz = paletteSz;
+            return !catexit_loopSafety;
+        }
+    }
+    
     size_t inScrSz = inSz * sizeof(uint32_t);
     uint32_t *inScr = malloc(inScrSz);
-    if (!inScr)
+    if (!inScr) {
+        if (red != in)
+            free(red);
         return true;
+    }
     
-    // Quantize by octree
-    OCQOctreeQuantizer_t *octree = OCQOctreeQuantizer___init__();
-    for (size_t y = 0; catexit_loopSafety && y < h; y++) {
-        for (size_t x = 0; catexit_loopSafety && x < w; x++) {
-            // TODO: Seperate flipping flag? Or somehow check if the original image is flipped? Or should TGA ALWAYS decode data to be upright?
-            size_t fy = y; //opts->flipY ? Math_FlipSz(y, h) : y;
-            size_t fx = x; //opts->flipX ? Math_FlipSz(x, w) : x;
-            
-            uint32_t inClr = *(in + (fy * w + fx));
-            *(inScr + (fy * w + fx)) = inClr;
-            OCQOctreeQuantizer_add_color_raw(octree, inClr);
+    OCQOctreeQuantizer_t *octree = NULL;
+    OCQLookupCache_t octreeCache = { 0 };
+    uint16_t *iaTable = NULL;
+    GXPalSoA_t soa = { 0 };
+    GXClrMap_t nearest = { 0 };
+    if (isIA8) {
+        // Work in intensity and alpha only, gray colors stay gray through error diffusion
+        for (size_t i = 0; catexit_loopSafety && i < inSz; i++) {
+            uint8_t ci = Clr_Average(in[i], opts);
+            inScr[i] = Clr_FromIA(ci, (in[i] >> GX_COMP_SH_A) & 0xFF);
+        }
+        
+        iaTable = calloc(0x10000, sizeof(uint16_t));
+        if (!iaTable || IA8_MakePalette(inSz, inScr, palSz, pal, &paletteSz, opts)) {
+            free(iaTable);
+            free(inScr);
+            return true;
+        }
+    } else {
+        bool fail = RGBA_MakePalette(w, h, inSz, red, palSz, pal, &paletteSz, &octree, opts);
+        
+        // Without error diffusion, look colors up in the octree at the precision they were added at so they land
+        // in the same leaves
+        memcpy(inScr, octree && opts->ditherType == GX_DT_THRESHOLD ? red : in, inScrSz);
+        if (red != in)
+            free(red);
+        
+        // Dither against the colors the palette will actually decode to
+        for (size_t i = 0; !fail && i < paletteSz; i++)
+            pal[i] = Clr_Reduce(pal[i], opts->palFmt);
+        
+        // Only error diffusion looks colors up one at a time through the nearest color map
+        if (fail || (!octree && (PalSoA_Init(&soa, paletteSz, pal)
+        || (opts->ditherType != GX_DT_THRESHOLD && ClrMap_Init(&nearest, paletteSz * 4))))) {
+            Octree_Release(octree, opts);
+            PalSoA_Free(&soa);
+            free(inScr);
+            return true;
         }
     }
+    *outPalSz = paletteSz;
     
-    size_t paletteSz = 0;
-    OCQOctreeQuantizer_make_palette_raw(octree, palSz, pal, &paletteSz);
-    if (!paletteSz) {
-        OCQOctreeQuantizer_free(octree);
+    // Without error diffusion every pixel maps on its own, so rows are spread across threads
+    if (opts->ditherType == GX_DT_THRESHOLD && !iaTable) {
+        OCQFrozenPalette_t *frozen = NULL;
+        if (octree && !(frozen = OCQOctreeQuantizer_freeze(octree))) {
+            Octree_Release(octree, opts);
+            free(inScr);
+            *outPalSz = 0;
+            return true;
+        }
+        
+#ifdef _OPENMP
+        #pragma omp parallel for schedule(static)
+#endif
+        for (int32_t y = 0; y < (int32_t) h; y++) {
+            uint32_t *rowIn = inScr + ((size_t) y * w);
+            uint32_t *rowOut = outIdx + ((size_t) y * w);
+            if (frozen)
+                OCQFrozenPalette_map_raw(frozen, w, rowIn, rowOut);
+            else {
+                uint32_t palIdx = 0;
+                for (size_t x = 0; x < w; x++) {
+                    if (!x || rowIn[x] != rowIn[x - 1]) {
+                        float clr[4];
+                        Clr_ToFloats(rowIn[x], clr);
+                        palIdx = (uint32_t) PalSoA_Nearest(&soa, clr);
+                    }
+                    rowOut[x] = palIdx;
+                }
+            }
+        }
+        
+        // Frozen palettes are shared across threads and keep no counters, count their lookups here
+        if (frozen && opts->octreeStats)
+            opts->octreeStats->lookups += inSz;
+        OCQFrozenPalette_free(frozen);
+        Octree_Release(octree, opts);
+        PalSoA_Free(&soa);
         free(inScr);
-        return true;
+        
+        return !catexit_loopSafety;
     }
-    *outPalSz = paletteSz;
     
     for (size_t y = 0; catexit_loopSafety && y < h; y++) {
         for (size_t x = 0; catexit_loopSafety && x < w; x++) {
@@ -1199,7 +2076,22 @@ uint32_t *outIdx, size_t *outPalSz, GXEncodeOptions_t *opts) {
             uint32_t inScrClr = *inScrPtr;
             
             // Dither by error diffusion
-            size_t palIdx = OCQOctreeQuantizer_get_palette_index_raw(octree, inScrClr);
+            size_t palIdx;
+            if (iaTable)
+                palIdx = IA8_Nearest(paletteSz, pal, iaTable, inScrClr);
+            else if (octree)
+                palIdx = OCQOctreeQuantizer_get_palette_index_cached(octree, &octreeCache, inScrClr);
+            else
+                palIdx = PalSoA_NearestCached(&soa, &nearest, inScrClr);
+            if (palIdx == SIZE_MAX) {
+                Octree_Release(octree, opts);
+                free(iaTable);
+                ClrMap_Free(&nearest);
+                PalSoA_Free(&soa);
+                free(inScr);
+                *outPalSz = 0;
+                return true;
+            }
             *(outIdx + (fy * w + fx)) = palIdx;
             uint32_t palClr = pal[palIdx];
             uint32_t clrErr = Clr_Subtract(inScrClr, palClr);
@@ -1226,7 +2118,10 @@ uint32_t *outIdx, size_t *outPalSz, GXEncodeOptions_t *opts) {
         }
     }
     
-    OCQOctreeQuantizer_free(octree);
+    Octree_Release(octree, opts);
+    free(iaTable);
+    ClrMap_Free(&nearest);
+    PalSoA_Free(&soa);
     free(inScr);
     
     return !catexit_loopSafety;
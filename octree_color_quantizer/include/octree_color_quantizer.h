@@ -43,11 +43,17 @@ SOFTWARE.
 #endif
 
 typedef struct OCQColor OCQColor_t;
+typedef struct OCQColorSum OCQColorSum_t;
 typedef struct OCQColorArray OCQColorArray_t;
 typedef struct OCQOctreeNode OCQOctreeNode_t;
-typedef struct OCQOctreeNodeTable OCQOctreeNodeTable_t;
+typedef struct OCQOctreeNodeArena OCQOctreeNodeArena_t;
 typedef struct OCQOctreeNodeArray OCQOctreeNodeArray_t;
+typedef struct OCQStats OCQStats_t;
+typedef struct OCQOctreeQuantizerOptions OCQOctreeQuantizerOptions_t;
 typedef struct OCQOctreeQuantizer OCQOctreeQuantizer_t;
+typedef struct OCQLookupCache OCQLookupCache_t;
+typedef struct OCQFrozenNode OCQFrozenNode_t;
+typedef struct OCQFrozenPalette OCQFrozenPalette_t;
 
 // OCQColor class
 struct OCQColor {
@@ -57,52 +63,167 @@ struct OCQColor {
     int32_t alpha;
 };
 
+// Channel sums of the colors added to a node, wide enough for any image size
+struct OCQColorSum {
+    int64_t red;
+    int64_t green;
+    int64_t blue;
+    int64_t alpha;
+};
+
 struct OCQColorArray {
-    OCQColor_t **arr;
+    OCQColor_t *arr;
 };
 
 // Octree Node class for color quantization
+// Children are indices into the owner's node arena, 0 (the root, which is never a child) means no child
+// A leaf merged into a sibling while making the palette keeps its place in the tree, but takes the palette index of
+// the sibling it names in `alias`
+// Nodes have 16 children split on RGBA bits, or 8 split on RGB bits when the owner ignores alpha
+// That is 120 or 88 bytes on 64 bit targets, RGB nodes still sum alpha so they are not half the size
 struct OCQOctreeNode {
-    OCQColor_t *color;
-    int32_t pixel_count;
+    OCQColorSum_t color;
+    int64_t pixel_count;
     size_t palette_index;
-    OCQOctreeNode_t *children[16];
+    uint32_t parent;
+    uint32_t alias;
+    uint32_t children[];
 };
 
-struct OCQOctreeNodeTable {
-    struct {
-        OCQOctreeNode_t *key;
-        OCQOctreeNode_t *value;
-    } *table;
+// Nodes are allocated in fixed size chunks that never move, and are all released together
+// Nodes merged away while adding colors are kept on a free list for reuse
+struct OCQOctreeNodeArena {
+    uint8_t **chunks;
+    size_t node_size;
+    uint32_t count;
+    uint32_t *free_nodes;
 };
 
 struct OCQOctreeNodeArray {
-    OCQOctreeNode_t **arr;
+    uint32_t *arr;
+};
+
+// Counters of the work done by quantizers, which add to them as they go
+// Every counter is a total over the quantizers sharing it except the peaks, the most held by any one of them
+struct OCQStats {
+    // Nodes allocated, counting the ones reused after being freed
+    size_t nodes_allocated;
+    // Most nodes held at once
+    size_t peak_nodes;
+    // Bytes of nodes in use, nodes freed for reuse or dropped by a reset or free no longer count
+    size_t bytes;
+    // Most bytes of nodes in use at once
+    size_t peak_bytes;
+    // Leaves when making palettes, before and after reducing them down to the palette size
+    size_t leaves_before_reduction;
+    size_t leaves_after_reduction;
+    // Nodes reduced into leaves at each level below the root, to bound memory or to make palettes
+    size_t reductions[OCQ_MAX_DEPTH];
+    // Palette index lookups, including ones served from a lookup cache
+    size_t lookups;
+};
+
+struct OCQOctreeQuantizerOptions {
+    // Most leaves to hold while adding colors, the deepest level is reduced whenever there are more
+    // Should be at least the palette size, 0 for no limit
+    size_t leaf_cap;
+    // Split colors on RGB bits only, halving the size of every node
+    // Only for colors that all have the same alpha, which is then kept as is in the palette
+    bool rgb_only;
+    // Levels to split colors over, fewer is faster but coarser
+    // At most OCQ_MAX_DEPTH, 0 for OCQ_MAX_DEPTH
+    int32_t max_depth;
+    // Counters to add the work of the quantizer to, NULL for none
+    // Quantizers used on different threads need their own, and lookups from several threads at once need none
+    // Must outlive the quantizer, or its next reset
+    OCQStats_t *stats;
 };
 
 // Octree Quantizer class for image color quantization
-// Use MAX_DEPTH to limit a number of levels
+// Use MAX_DEPTH to limit a number of levels, `levels` only holds the first `max_depth`
 struct OCQOctreeQuantizer {
-    OCQColor_t *tmp_color;
-    OCQOctreeNodeTable_t *free_table;
+    size_t leaf_cap;
+    size_t leaf_count;
+    uint32_t child_count;
+    int32_t max_depth;
+    OCQStats_t *stats;
+    OCQOctreeNodeArena_t arena;
     OCQOctreeNodeArray_t *levels[OCQ_MAX_DEPTH];
     // Root must always be last member/initialized
-    OCQOctreeNode_t *root;
+    uint32_t root;
 };
 
-// Init Octree Quantizer
-OCQ_EXPORT OCQOctreeQuantizer_t *OCQOctreeQuantizer___init__(void);
+// Last color looked up and its palette index, owned by the caller
+struct OCQLookupCache {
+    bool valid;
+    uint32_t color;
+    size_t palette_index;
+};
+
+// Node of a frozen palette
+struct OCQFrozenNode {
+    bool is_leaf;
+    size_t palette_index;
+};
+
+// Immutable copy of the lookup tree of a quantizer whose palette has been made, safe to share across threads
+// The children of node `i` are `children[i * child_count]` onwards, indexing `nodes` with 0 meaning no child
+struct OCQFrozenPalette {
+    size_t node_count;
+    uint32_t child_count;
+    OCQFrozenNode_t *nodes;
+    uint32_t *children;
+};
+
+// Add the counters of `src` to `dst`
+OCQ_EXPORT void OCQStats_add(OCQStats_t *dst, const OCQStats_t *src);
+
+// Init Octree Quantizer with `opts`, or the defaults if NULL
+OCQ_EXPORT OCQOctreeQuantizer_t *OCQOctreeQuantizer___init__(const OCQOctreeQuantizerOptions_t *opts);
 
 // Free Octree Quantizer
 OCQ_EXPORT void OCQOctreeQuantizer_free(OCQOctreeQuantizer_t *self);
 
+// Clear Octree Quantizer for reuse with `opts`, or the defaults if NULL, keeping its node storage when the node layout
+// stays the same
+// Returns false if it could not be cleared, leaving it empty but unusable until reset again or freed
+OCQ_EXPORT bool OCQOctreeQuantizer_reset(OCQOctreeQuantizer_t *self, const OCQOctreeQuantizerOptions_t *opts);
+
 // Add `color` to the Octree (in raw uint32_t form)
 OCQ_EXPORT void OCQOctreeQuantizer_add_color_raw(OCQOctreeQuantizer_t *self, uint32_t color);
 
+// Add `color` to the Octree `weight` times (in raw uint32_t form)
+OCQ_EXPORT void OCQOctreeQuantizer_add_color_weighted(OCQOctreeQuantizer_t *self, uint32_t color, uint32_t weight);
+
+// Add `count` colors to the Octree (in raw uint32_t form), inserting each distinct color once with its count
+OCQ_EXPORT void OCQOctreeQuantizer_add_colors_raw(OCQOctreeQuantizer_t *self, const uint32_t *colors, size_t count);
+
+// Add the counts and sums accumulated by `src` into `dst`, `src` is left as is
+OCQ_EXPORT void OCQOctreeQuantizer_merge(OCQOctreeQuantizer_t *dst, const OCQOctreeQuantizer_t *src);
+
 // Make color palette with `color_count` colors maximum (in raw uint32_t form)
 OCQ_EXPORT void OCQOctreeQuantizer_make_palette_raw(OCQOctreeQuantizer_t *self, size_t color_count, uint32_t *palette,
 size_t *out_size);
 
 // Get palette index for `color` (in raw size_t form)
-OCQ_EXPORT size_t OCQOctreeQuantizer_get_palette_index_raw(OCQOctreeQuantizer_t *self, uint32_t color);
+OCQ_EXPORT size_t OCQOctreeQuantizer_get_palette_index_raw(const OCQOctreeQuantizer_t *self, uint32_t color);
+
+// Get palette index for `color` (in raw size_t form), reusing the last lookup in `cache` for runs of the same color
+// `cache` must start zeroed
+OCQ_EXPORT size_t OCQOctreeQuantizer_get_palette_index_cached(const OCQOctreeQuantizer_t *self,
+OCQLookupCache_t *cache, uint32_t color);
+
+// Freeze the lookup tree of `self`, call after making the palette
+// The frozen palette does not refer back to `self`, which may be freed or changed afterwards
+OCQ_EXPORT OCQFrozenPalette_t *OCQOctreeQuantizer_freeze(const OCQOctreeQuantizer_t *self);
+
+// Free Frozen Palette
+OCQ_EXPORT void OCQFrozenPalette_free(OCQFrozenPalette_t *self);
+
+// Get palette index for `color` (in raw size_t form)
+OCQ_EXPORT size_t OCQFrozenPalette_get_palette_index_raw(const OCQFrozenPalette_t *self, uint32_t color);
+
+// Map `count` raw colors to their palette indices
+OCQ_EXPORT void OCQFrozenPalette_map_raw(const OCQFrozenPalette_t *self, size_t count, const uint32_t *colors,
+uint32_t *indices);
 #endif
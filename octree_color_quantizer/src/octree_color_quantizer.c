@@ -26,11 +26,33 @@ SOFTWARE.
 #include <octree_color_quantizer.h>
 
 #include <stdlib.h>
+#include <string.h>
 #include <limits.h>
 
 #include <stdext/cmath.h>
 #include <stb_ds.h>
 
+// Nodes per arena chunk (as a shift)
+#define OCQ_ARENA_CHUNK_SH 12
+#define OCQ_ARENA_CHUNK_SZ (1 << OCQ_ARENA_CHUNK_SH)
+
+// Children of each node when splitting on RGBA bits, and on RGB bits only
+#define OCQ_CHILDREN_RGBA 16
+#define OCQ_CHILDREN_RGB 8
+
+// C99 has no _Static_assert, a negative array size fails the build instead
+#define OCQ_STATIC_ASSERT(cond, name) typedef char OCQStaticAssert_##name[(cond) ? 1 : -1]
+
+// Bytes per node on 64 bit targets, keep new fields from growing nodes unnoticed
+#if SIZE_MAX == UINT64_MAX
+OCQ_STATIC_ASSERT(sizeof(OCQOctreeNode_t) + OCQ_CHILDREN_RGBA * sizeof(uint32_t) == 120, node_size_rgba);
+OCQ_STATIC_ASSERT(sizeof(OCQOctreeNode_t) + OCQ_CHILDREN_RGB * sizeof(uint32_t) == 88, node_size_rgb);
+#endif
+
+// Colors counted at a time by OCQOctreeQuantizer_add_colors_raw, and the size of its hash table
+#define OCQ_BULK_CHUNK 4096
+#define OCQ_BULK_SLOTS (OCQ_BULK_CHUNK * 2)
+
 static OCQColorArray_t *OCQColorArray___init__(void) {
     OCQColorArray_t *self = malloc(sizeof(OCQColorArray_t));
     self->arr = NULL;
@@ -42,45 +64,75 @@ static void OCQColorArray_free(OCQColorArray_t *self) {
         return;
     
     arrfree(self->arr);
-    free(self->arr);
     free(self);
 }
 
-static OCQOctreeNodeTable_t *OCQOctreeNodeTable___init__(void) {
-    OCQOctreeNodeTable_t *self = malloc(sizeof(OCQOctreeNodeTable_t));
-    self->table = NULL;
+static OCQOctreeNodeArray_t *OCQOctreeNodeArray___init__(void) {
+    OCQOctreeNodeArray_t *self = malloc(sizeof(OCQOctreeNodeArray_t));
+    self->arr = NULL;
     return self;
 }
 
-static void OCQOctreeNodeTable_free(OCQOctreeNodeTable_t *self) {
+static void OCQOctreeNodeArray_free(OCQOctreeNodeArray_t *self) {
     if (!self)
         return;
     
-    hmfree(self->table);
-    free(self->table);
+    arrfree(self->arr);
     free(self);
 }
 
-static OCQOctreeNodeArray_t *OCQOctreeNodeArray___init__(void) {
-    OCQOctreeNodeArray_t *self = malloc(sizeof(OCQOctreeNodeArray_t));
-    self->arr = NULL;
-    return self;
+// Node waiting to be reduced and the pixels under it
+typedef struct OCQReduceEntry {
+    int64_t pixel_count;
+    uint32_t node;
+} OCQReduceEntry_t;
+
+// Order entries by pixel count, then by node index so that equal counts reduce the same way every time
+FORCE_INLINE bool OCQReduceEntry_less(const OCQReduceEntry_t *a, const OCQReduceEntry_t *b) {
+    return a->pixel_count < b->pixel_count || (a->pixel_count == b->pixel_count && a->node < b->node);
 }
 
-static void OCQOctreeNodeArray_free(OCQOctreeNodeArray_t *self) {
+// Release every chunk of the arena at once
+static void OCQOctreeNodeArena_free(OCQOctreeNodeArena_t *self) {
     if (!self)
         return;
     
-    arrfree(self->arr);
-    free(self->arr);
-    free(self);
+    for (size_t i = 0; i < arrlenu(self->chunks); i++)
+        free(self->chunks[i]);
+    arrfree(self->chunks);
+    arrfree(self->free_nodes);
+    self->count = 0;
+}
+
+// Get the node at `index`
+FORCE_INLINE OCQOctreeNode_t *OCQOctreeNodeArena_get(const OCQOctreeNodeArena_t *self, uint32_t index) {
+    return (OCQOctreeNode_t *) (self->chunks[index >> OCQ_ARENA_CHUNK_SH] + (index & (OCQ_ARENA_CHUNK_SZ - 1)) *
+        self->node_size);
+}
+
+// Take a freed node, or the next node of the arena, adding a chunk when full
+// Returns UINT32_MAX on allocation failure
+static uint32_t OCQOctreeNodeArena_alloc(OCQOctreeNodeArena_t *self) {
+    if (arrlenu(self->free_nodes))
+        return arrpop(self->free_nodes);
+    
+    if (self->count == UINT32_MAX)
+        return UINT32_MAX;
+    
+    if (!(self->count & (OCQ_ARENA_CHUNK_SZ - 1)) && (self->count >> OCQ_ARENA_CHUNK_SH) == arrlenu(self->chunks)) {
+        uint8_t *chunk = malloc(OCQ_ARENA_CHUNK_SZ * self->node_size);
+        if (!chunk)
+            return UINT32_MAX;
+        arrput(self->chunks, chunk);
+    }
+    return self->count++;
 }
 
-// Get index of `color` for next `level`
-static int32_t get_color_index_for_level(OCQColor_t *color, int32_t level) {
+// Get index of `color` for next `level`, among `child_count` children
+static int32_t get_color_index_for_level(const OCQColor_t *color, int32_t level, uint32_t child_count) {
     int32_t index = 0;
     int32_t mask = 0x80 >> level;
-    if (color->alpha & mask)
+    if (child_count == OCQ_CHILDREN_RGBA && (color->alpha & mask))
         index |= 8;
     if (color->red & mask)
         index |= 4;
@@ -91,77 +143,87 @@ static int32_t get_color_index_for_level(OCQColor_t *color, int32_t level) {
     return index;
 }
 
-// Initialize color
-static OCQColor_t *OCQColor___init__(int32_t red, int32_t green, int32_t blue, int32_t alpha) {
-    OCQColor_t *self = malloc(sizeof(OCQColor_t));
-    self->red = red;
-    self->green = green;
-    self->blue = blue;
-    self->alpha = alpha;
+// Unpack a raw uint32_t color
+FORCE_INLINE OCQColor_t OCQColor_from_raw(uint32_t color) {
+    OCQColor_t self = {
+        .red = (color >> OCQ_COMP_SH_R) & 0xFF,
+        .green = (color >> OCQ_COMP_SH_G) & 0xFF,
+        .blue = (color >> OCQ_COMP_SH_B) & 0xFF,
+        .alpha = (color >> OCQ_COMP_SH_A) & 0xFF
+    };
     return self;
 }
 
-// Free color
-static void OCQColor_free(OCQColor_t *self) {
-    free(self);
-}
-
-
-void OCQOctreeQuantizer_add_level_node(OCQOctreeQuantizer_t *self, int32_t level, OCQOctreeNode_t *node);
-// Init new Octree Node
-static OCQOctreeNode_t *OCQOctreeNode___init__(int32_t level, OCQOctreeQuantizer_t *owner) {
-    if (level < 0 || level > OCQ_MAX_DEPTH || !owner)
-        return NULL;
+void OCQOctreeQuantizer_add_level_node(OCQOctreeQuantizer_t *self, int32_t level, uint32_t node);
+// Init new Octree Node under `parent` (UINT32_MAX for the root)
+// Returns its index, or UINT32_MAX on failure
+static uint32_t OCQOctreeNode___init__(int32_t level, uint32_t parent, OCQOctreeQuantizer_t *owner) {
+    if (!owner || level < 0 || level > owner->max_depth)
+        return UINT32_MAX;
+    
+    uint32_t index = OCQOctreeNodeArena_alloc(&owner->arena);
+    if (index == UINT32_MAX)
+        return UINT32_MAX;
+    
+    if (owner->stats) {
+        size_t live = owner->arena.count - arrlenu(owner->arena.free_nodes);
+        owner->stats->nodes_allocated++;
+        if (owner->stats->peak_nodes < live)
+            owner->stats->peak_nodes = live;
+        owner->stats->bytes += owner->arena.node_size;
+        if (owner->stats->peak_bytes < owner->stats->bytes)
+            owner->stats->peak_bytes = owner->stats->bytes;
+    }
     
-    OCQOctreeNode_t *self = malloc(sizeof(OCQOctreeNode_t));
-    self->color = OCQColor___init__(0, 0, 0, 0);
+    OCQOctreeNode_t *self = OCQOctreeNodeArena_get(&owner->arena, index);
+    self->color.red = 0;
+    self->color.green = 0;
+    self->color.blue = 0;
+    self->color.alpha = 0;
     self->pixel_count = 0;
     self->palette_index = 0;
-    for (int32_t i = 0; i < 16; i++)
-        self->children[i] = NULL;
-    hmput(owner->free_table->table, self, self);
+    self->parent = parent;
+    self->alias = 0;
+    for (uint32_t i = 0; i < owner->child_count; i++)
+        self->children[i] = 0;
     // add node to current level
-    if (level < OCQ_MAX_DEPTH - 1)
-        OCQOctreeQuantizer_add_level_node(owner, level, self);
-    return self;
+    if (level < owner->max_depth - 1)
+        OCQOctreeQuantizer_add_level_node(owner, level, index);
+    return index;
 }
 
-// Free Octree Node
-static void OCQOctreeNode_free(OCQOctreeNode_t *self, bool recursive, OCQOctreeQuantizer_t *owner) {
-    if (!self || !owner || hmgeti(owner->free_table->table, self) == -1)
-        return;
-    
-    OCQOctreeNodeArray_t *stack = OCQOctreeNodeArray___init__();
-    arrpush(stack->arr, self);
-    while (arrlenu(stack->arr)) {
-        OCQOctreeNode_t *node = arrpop(stack->arr);
-        
-        if (recursive) {
-            for (int32_t i = 0; i < 16; i++) {
-                OCQOctreeNode_t *child = node->children[i];
-                if (child && hmgeti(owner->free_table->table, child) != -1)
-                    arrpush(stack->arr, child);
-            }
-        }
-        
-        hmdel(owner->free_table->table, node);
-        OCQColor_free(node->color);
-        free(node);
-    }
-    OCQOctreeNodeArray_free(stack);
+// Put the node at `index` of `owner` on the free list for reuse
+FORCE_INLINE void OCQOctreeNode_release(uint32_t index, OCQOctreeQuantizer_t *owner) {
+    arrput(owner->arena.free_nodes, index);
+    if (owner->stats)
+        owner->stats->bytes -= owner->arena.node_size;
+}
+
+// Check that `index` is a node of `owner`
+// Nodes stay alive until the whole arena is released, so every index handed out so far is
+FORCE_INLINE bool OCQOctreeNode_is_live(uint32_t index, const OCQOctreeQuantizer_t *owner) {
+    return index < owner->arena.count;
+}
+
+// Get the level of `self`, counting up its parents to the root
+static int32_t OCQOctreeNode_get_level(uint32_t self, const OCQOctreeQuantizer_t *owner) {
+    int32_t level = 0;
+    for (uint32_t parent = OCQOctreeNodeArena_get(&owner->arena, self)->parent; parent != UINT32_MAX; level++)
+        parent = OCQOctreeNodeArena_get(&owner->arena, parent)->parent;
+    return level;
 }
 
 // Check that node is leaf
-static bool OCQOctreeNode_is_leaf(OCQOctreeNode_t *self, OCQOctreeQuantizer_t *owner) {
-    if (!self || !owner || hmgeti(owner->free_table->table, self) == -1)
+static bool OCQOctreeNode_is_leaf(uint32_t self, OCQOctreeQuantizer_t *owner) {
+    if (!owner || !OCQOctreeNode_is_live(self, owner))
         return false;
     
-    return self->pixel_count > 0;
+    return OCQOctreeNodeArena_get(&owner->arena, self)->pixel_count > 0;
 }
 
 // Get all leaf nodes
-static OCQOctreeNodeArray_t *OCQOctreeNode_get_leaf_nodes(OCQOctreeNode_t *self, OCQOctreeQuantizer_t *owner) {
-    if (!self || !owner || hmgeti(owner->free_table->table, self) == -1)
+static OCQOctreeNodeArray_t *OCQOctreeNode_get_leaf_nodes(uint32_t self, OCQOctreeQuantizer_t *owner) {
+    if (!owner || !OCQOctreeNode_is_live(self, owner))
         return NULL;
     
     OCQOctreeNodeArray_t *leaf_nodes = OCQOctreeNodeArray___init__();
@@ -169,14 +231,15 @@ static OCQOctreeNodeArray_t *OCQOctreeNode_get_leaf_nodes(OCQOctreeNode_t *self,
     OCQOctreeNodeArray_t *stack = OCQOctreeNodeArray___init__();
     arrpush(stack->arr, self);
     while (arrlenu(stack->arr)) {
-        OCQOctreeNode_t *node = arrpop(stack->arr);
+        uint32_t index = arrpop(stack->arr);
         
-        if (OCQOctreeNode_is_leaf(node, owner))
-            arrput(leaf_nodes->arr, node);
+        if (OCQOctreeNode_is_leaf(index, owner))
+            arrput(leaf_nodes->arr, index);
         else {
-            for (int32_t i = 16; i >= 0; i--) {
-                OCQOctreeNode_t *child = node->children[i];
-                if (child && hmgeti(owner->free_table->table, child) != -1)
+            OCQOctreeNode_t *node = OCQOctreeNodeArena_get(&owner->arena, index);
+            for (int32_t i = (int32_t) owner->child_count - 1; i >= 0; i--) {
+                uint32_t child = node->children[i];
+                if (child)
                     arrpush(stack->arr, child);
             }
         }
@@ -187,122 +250,154 @@ static OCQOctreeNodeArray_t *OCQOctreeNode_get_leaf_nodes(OCQOctreeNode_t *self,
 }
 
 // Get a sum of pixel count for node and its children
-static USED int32_t OCQOctreeNode_get_nodes_pixel_count(OCQOctreeNode_t *self, OCQOctreeQuantizer_t *owner) {
-    if (!self || !owner || hmgeti(owner->free_table->table, self) == -1)
+static USED int64_t OCQOctreeNode_get_nodes_pixel_count(uint32_t self, OCQOctreeQuantizer_t *owner) {
+    if (!owner || !OCQOctreeNode_is_live(self, owner))
         return 0;
     
-    int32_t sum_count = self->pixel_count;
-    for(int32_t i = 0; i < 16; i++) {
-        OCQOctreeNode_t *child = self->children[i];
-        if (child && hmgeti(owner->free_table->table, child) != -1)
-            sum_count += child->pixel_count;
+    OCQOctreeNode_t *node = OCQOctreeNodeArena_get(&owner->arena, self);
+    int64_t sum_count = node->pixel_count;
+    for(uint32_t i = 0; i < owner->child_count; i++) {
+        uint32_t child = node->children[i];
+        if (child)
+            sum_count += OCQOctreeNodeArena_get(&owner->arena, child)->pixel_count;
     }
     return sum_count;
 }
 
-// Add `color` to the tree
-static void OCQOctreeNode_add_color(OCQOctreeNode_t *self, OCQColor_t *color, int32_t level,
-OCQOctreeQuantizer_t *owner) {
-    if (!self || !color || !owner || hmgeti(owner->free_table->table, self) == -1)
+// Add `count` pixels with the channel sums `sum` to the tree, along the path of `color`
+static void OCQOctreeNode_add_sum(uint32_t self, const OCQColor_t *color, const OCQColorSum_t *sum, int64_t count,
+int32_t level, OCQOctreeQuantizer_t *owner) {
+    if (!color || !sum || count <= 0 || !owner || !OCQOctreeNode_is_live(self, owner))
         return;
     
-    OCQOctreeNode_t *node = self;
-    while (level < OCQ_MAX_DEPTH) {
-        int32_t index = get_color_index_for_level(color, level);
-        if (!node->children[index] || hmgeti(owner->free_table->table, node->children[index]) == -1)
-            node->children[index] = OCQOctreeNode___init__(level, owner);
-        node = node->children[index];
+    // Stop early at nodes that were reduced into leaves
+    uint32_t nodeIndex = self;
+    OCQOctreeNode_t *node = OCQOctreeNodeArena_get(&owner->arena, nodeIndex);
+    while (level < owner->max_depth && node->pixel_count <= 0) {
+        int32_t index = get_color_index_for_level(color, level, owner->child_count);
+        if (!node->children[index]) {
+            uint32_t child = OCQOctreeNode___init__(level, nodeIndex, owner);
+            if (child == UINT32_MAX)
+                return;
+            node->children[index] = child;
+        }
+        nodeIndex = node->children[index];
+        node = OCQOctreeNodeArena_get(&owner->arena, nodeIndex);
         level++;
     }
     
-    node->color->red += color->red;
-    node->color->green += color->green;
-    node->color->blue += color->blue;
-    node->color->alpha += color->alpha;
-    node->pixel_count++;
+    if (node->pixel_count <= 0)
+        owner->leaf_count++;
+    node->color.red += sum->red;
+    node->color.green += sum->green;
+    node->color.blue += sum->blue;
+    node->color.alpha += sum->alpha;
+    node->pixel_count += count;
 }
 
-// Get palette index for `color`
-// Uses `level` to go one level deeper if the node is not a leaf
-static size_t OCQOctreeNode_get_palette_index(OCQOctreeNode_t *self, OCQColor_t *color, int32_t level,
+// Add `color` to the tree `weight` times
+static void OCQOctreeNode_add_color(uint32_t self, const OCQColor_t *color, int64_t weight, int32_t level,
 OCQOctreeQuantizer_t *owner) {
-    if (!self ||!color || level < 0 || level > OCQ_MAX_DEPTH || !owner || hmgeti(owner->free_table->table, self) == -1)
-        return 0;
-    
-    size_t palette_index = SIZE_MAX;
-    
-    OCQOctreeNodeArray_t *stack = OCQOctreeNodeArray___init__();
-    arrpush(stack->arr, self);
-    while (arrlenu(stack->arr)) {
-        OCQOctreeNode_t *node = arrpop(stack->arr);
-        if (OCQOctreeNode_is_leaf(node, owner)) {
-            palette_index = node->palette_index;
-            break;
-        }
-        
-        OCQOctreeNode_t *newNode = NULL;
-        int32_t index = get_color_index_for_level(color, level);
-        if (node->children[index] && hmgeti(owner->free_table->table, node->children[index]) != -1)
-            newNode = node->children[index];
-        else
-            // get palette index for a first found child node
-            for(int32_t i = 0; i < 16; i++)
-                if (node->children[i] && hmgeti(owner->free_table->table, node->children[i]) != -1)
-                    newNode = node->children[i];
-        
-        if (newNode) {
-            arrpush(stack->arr, newNode);
-            level++;
-        }
-    }
-    OCQOctreeNodeArray_free(stack);
+    if (!color || weight <= 0)
+        return;
     
-    return palette_index;
+    OCQColorSum_t sum = {
+        .red = color->red * weight,
+        .green = color->green * weight,
+        .blue = color->blue * weight,
+        .alpha = color->alpha * weight
+    };
+    OCQOctreeNode_add_sum(self, color, &sum, weight, level, owner);
 }
 
-// Add all children pixels count and color channels to parent node 
-// Return the number of removed leaves
-static int32_t OCQOctreeNode_remove_leaves(OCQOctreeNode_t *self, OCQOctreeQuantizer_t *owner) {
-    if (!self || !owner || hmgeti(owner->free_table->table, self) == -1)
+// Get palette index for `color`
+// Descends from `self` at `level` without allocating, taking another child where `color` has no path
+static size_t OCQOctreeNode_get_palette_index(uint32_t self, const OCQColor_t *color, int32_t level,
+const OCQOctreeQuantizer_t *owner) {
+    if (!color || !owner || level < 0 || level > owner->max_depth || !OCQOctreeNode_is_live(self, owner))
         return 0;
     
-    int32_t result = 0;
-    for(int32_t i = 0; i < 16; i++) {
-        OCQOctreeNode_t *node = self->children[i];
-        if (node && hmgeti(owner->free_table->table, node) != -1) {
-            self->color->red += node->color->red;
-            self->color->green += node->color->green;
-            self->color->blue += node->color->blue;
-            self->color->alpha += node->color->alpha;
-            self->pixel_count += node->pixel_count;
-            result++;
+    const OCQOctreeNode_t *node = OCQOctreeNodeArena_get(&owner->arena, self);
+    while (node->pixel_count <= 0) {
+        uint32_t newNode = node->children[get_color_index_for_level(color, level, owner->child_count)];
+        if (!newNode) {
+            // get palette index for the last found child node
+            for (int32_t i = (int32_t) owner->child_count - 1; i >= 0 && !newNode; i--)
+                newNode = node->children[i];
+            if (!newNode)
+                return SIZE_MAX;
         }
+        node = OCQOctreeNodeArena_get(&owner->arena, newNode);
+        level++;
     }
-    return result - 1;
+    return node->palette_index;
 }
 
 // Get average color
-static OCQColor_t *OCQOctreeNode_get_color(OCQOctreeNode_t *self, OCQOctreeQuantizer_t *owner) {
-    if (!self || !owner || hmgeti(owner->free_table->table, self) == -1)
-        return NULL;
+static OCQColor_t OCQOctreeNode_get_color(uint32_t self, OCQOctreeQuantizer_t *owner) {
+    OCQColor_t color = { 0, 0, 0, 0 };
+    if (!owner || !OCQOctreeNode_is_live(self, owner))
+        return color;
+    
+    OCQOctreeNode_t *node = OCQOctreeNodeArena_get(&owner->arena, self);
+    color.red = (int32_t) (node->color.red / node->pixel_count);
+    color.green = (int32_t) (node->color.green / node->pixel_count);
+    color.blue = (int32_t) (node->color.blue / node->pixel_count);
+    color.alpha = (int32_t) (node->color.alpha / node->pixel_count);
+    return color;
+}
+
+// Add the counters of `src` to `dst`
+OCQ_EXPORT void OCQStats_add(OCQStats_t *dst, const OCQStats_t *src) {
+    if (!dst || !src)
+        return;
     
-    return OCQColor___init__(
-        self->color->red / self->pixel_count,
-        self->color->green / self->pixel_count,
-        self->color->blue / self->pixel_count,
-        self->color->alpha / self->pixel_count
-    );
+    dst->nodes_allocated += src->nodes_allocated;
+    if (dst->peak_nodes < src->peak_nodes)
+        dst->peak_nodes = src->peak_nodes;
+    dst->bytes += src->bytes;
+    if (dst->peak_bytes < src->peak_bytes)
+        dst->peak_bytes = src->peak_bytes;
+    dst->leaves_before_reduction += src->leaves_before_reduction;
+    dst->leaves_after_reduction += src->leaves_after_reduction;
+    for (int32_t i = 0; i < OCQ_MAX_DEPTH; i++)
+        dst->reductions[i] += src->reductions[i];
+    dst->lookups += src->lookups;
+}
+
+// Take the settings of `opts`, or the defaults if NULL
+static void OCQOctreeQuantizer_set_options(OCQOctreeQuantizer_t *self, const OCQOctreeQuantizerOptions_t *opts) {
+    self->leaf_cap = opts ? opts->leaf_cap : 0;
+    self->child_count = opts && opts->rgb_only ? OCQ_CHILDREN_RGB : OCQ_CHILDREN_RGBA;
+    self->max_depth = opts && opts->max_depth > 0 && opts->max_depth < OCQ_MAX_DEPTH ? opts->max_depth : OCQ_MAX_DEPTH;
+    self->stats = opts ? opts->stats : NULL;
 }
 
-// Init Octree Quantizer
-OCQ_EXPORT OCQOctreeQuantizer_t *OCQOctreeQuantizer___init__(void) {
+// Take every node `self` holds off the bytes in use of its counters
+static void OCQOctreeQuantizer_release_bytes(OCQOctreeQuantizer_t *self) {
+    if (self->stats)
+        self->stats->bytes -= (self->arena.count - arrlenu(self->arena.free_nodes)) * self->arena.node_size;
+}
+
+// Init Octree Quantizer with `opts`, or the defaults if NULL
+OCQ_EXPORT OCQOctreeQuantizer_t *OCQOctreeQuantizer___init__(const OCQOctreeQuantizerOptions_t *opts) {
     OCQOctreeQuantizer_t *self = malloc(sizeof(OCQOctreeQuantizer_t));
-    self->tmp_color = OCQColor___init__(0, 0, 0, 0);
-    self->free_table = OCQOctreeNodeTable___init__();
+    if (!self)
+        return NULL;
+    OCQOctreeQuantizer_set_options(self, opts);
+    self->leaf_count = 0;
+    self->arena.chunks = NULL;
+    self->arena.node_size = sizeof(OCQOctreeNode_t) + self->child_count * sizeof(uint32_t);
+    self->arena.count = 0;
+    self->arena.free_nodes = NULL;
     for (int32_t i = 0; i < OCQ_MAX_DEPTH; i++)
         self->levels[i] = OCQOctreeNodeArray___init__();
     // Root must always be last member/initialized
-    self->root = OCQOctreeNode___init__(0, self);
+    self->root = OCQOctreeNode___init__(0, UINT32_MAX, self);
+    if (self->root == UINT32_MAX) {
+        OCQOctreeQuantizer_free(self);
+        return NULL;
+    }
     return self;
 }
 
@@ -311,26 +406,43 @@ OCQ_EXPORT void OCQOctreeQuantizer_free(OCQOctreeQuantizer_t *self) {
     if (!self)
         return;
     
-    OCQColor_free(self->tmp_color);
-    
     for (int32_t i = 0; i < OCQ_MAX_DEPTH; i++) {
         OCQOctreeNodeArray_free(self->levels[i]);
         self->levels[i] = NULL;
     }
     
-    OCQOctreeNodeArray_t *free_queue = OCQOctreeNodeArray___init__();
-    for (size_t i = 0; i < hmlenu(self->free_table->table); i++)
-        arrput(free_queue->arr, self->free_table->table[i].key);
-    
-    for (size_t i = 0; i < arrlenu(free_queue->arr); i++)
-        OCQOctreeNode_free(free_queue->arr[i], false, self);
-    OCQOctreeNodeArray_free(free_queue);
-    
-    OCQOctreeNodeTable_free(self->free_table);
+    OCQOctreeQuantizer_release_bytes(self);
+    OCQOctreeNodeArena_free(&self->arena);
     
     free(self);
 }
 
+// Clear Octree Quantizer for reuse with `opts`, or the defaults if NULL
+// Arena chunks and level arrays keep their allocations, the chunks are only released when the node size changes
+OCQ_EXPORT bool OCQOctreeQuantizer_reset(OCQOctreeQuantizer_t *self, const OCQOctreeQuantizerOptions_t *opts) {
+    if (!self)
+        return false;
+    
+    // Nodes held so far come off the counters they were added to, which may not be the new ones
+    OCQOctreeQuantizer_release_bytes(self);
+    OCQOctreeQuantizer_set_options(self, opts);
+    self->leaf_count = 0;
+    size_t node_size = sizeof(OCQOctreeNode_t) + self->child_count * sizeof(uint32_t);
+    if (self->arena.node_size != node_size) {
+        OCQOctreeNodeArena_free(&self->arena);
+        self->arena.node_size = node_size;
+    }
+    self->arena.count = 0;
+    if (self->arena.free_nodes)
+        arrsetlen(self->arena.free_nodes, 0);
+    for (int32_t i = 0; i < OCQ_MAX_DEPTH; i++)
+        if (self->levels[i] && self->levels[i]->arr)
+            arrsetlen(self->levels[i]->arr, 0);
+    // Root must always be last member/initialized
+    self->root = OCQOctreeNode___init__(0, UINT32_MAX, self);
+    return self->root != UINT32_MAX;
+}
+
 // Get all leaves
 static OCQOctreeNodeArray_t *OCQOctreeQuantizer_get_leaves(OCQOctreeQuantizer_t *self) {
     if (!self)
@@ -340,21 +452,56 @@ static OCQOctreeNodeArray_t *OCQOctreeQuantizer_get_leaves(OCQOctreeQuantizer_t
 }
 
 // Add `node` to the nodes at `level`
-void OCQOctreeQuantizer_add_level_node(OCQOctreeQuantizer_t *self, int32_t level, OCQOctreeNode_t *node) {
-    if (!self || level < 0 || level > OCQ_MAX_DEPTH || !node || hmgeti(self->free_table->table, node) == -1)
+void OCQOctreeQuantizer_add_level_node(OCQOctreeQuantizer_t *self, int32_t level, uint32_t node) {
+    if (!self || level < 0 || level > OCQ_MAX_DEPTH || !OCQOctreeNode_is_live(node, self))
         return;
     
     if (self->levels[level])
         arrput(self->levels[level]->arr, node);
 }
 
-// Add `color` to the Octree
-static void OCQOctreeQuantizer_add_color(OCQOctreeQuantizer_t *self, OCQColor_t *color) {
+// Merge the children of the most recently added node of the deepest level into it, freeing them for reuse
+// Nodes of deeper levels have all been reduced already, so the children are leaves
+static bool OCQOctreeQuantizer_reduce_deepest(OCQOctreeQuantizer_t *self) {
+    for (int32_t level = self->max_depth - 1; level >= 0; level--) {
+        if (!self->levels[level] || !arrlenu(self->levels[level]->arr))
+            continue;
+        
+        uint32_t index = arrpop(self->levels[level]->arr);
+        OCQOctreeNode_t *node = OCQOctreeNodeArena_get(&self->arena, index);
+        if (node->pixel_count <= 0)
+            self->leaf_count++;
+        if (self->stats)
+            self->stats->reductions[OCQOctreeNode_get_level(index, self)]++;
+        for (uint32_t i = 0; i < self->child_count; i++) {
+            uint32_t child = node->children[i];
+            if (child) {
+                OCQOctreeNode_t *leaf = OCQOctreeNodeArena_get(&self->arena, child);
+                node->color.red += leaf->color.red;
+                node->color.green += leaf->color.green;
+                node->color.blue += leaf->color.blue;
+                node->color.alpha += leaf->color.alpha;
+                node->pixel_count += leaf->pixel_count;
+                node->children[i] = 0;
+                OCQOctreeNode_release(child, self);
+                self->leaf_count--;
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+// Add `color` to the Octree `weight` times
+static void OCQOctreeQuantizer_add_color(OCQOctreeQuantizer_t *self, const OCQColor_t *color, int64_t weight) {
     if (!self || !color)
         return;
     
     // passes self value as `parent` to save nodes to levels dict
-    OCQOctreeNode_add_color(self->root, color, 0, self);
+    OCQOctreeNode_add_color(self->root, color, weight, 0, self);
+    
+    // Keep memory bounded by the leaf cap
+    while (self->leaf_cap && self->leaf_count > self->leaf_cap && OCQOctreeQuantizer_reduce_deepest(self));
 }
 
 // Add `color` to the Octree (in raw uint32_t form)
@@ -362,53 +509,279 @@ OCQ_EXPORT void OCQOctreeQuantizer_add_color_raw(OCQOctreeQuantizer_t *self, uin
     if (!self)
         return;
     
-    self->tmp_color->red = (color >> OCQ_COMP_SH_R) & 0xFF;
-    self->tmp_color->green = (color >> OCQ_COMP_SH_G) & 0xFF;
-    self->tmp_color->blue = (color >> OCQ_COMP_SH_B) & 0xFF;
-    self->tmp_color->alpha = (color >> OCQ_COMP_SH_A) & 0xFF;
+    OCQColor_t ocq_color = OCQColor_from_raw(color);
+    OCQOctreeQuantizer_add_color(self, &ocq_color, 1);
+}
+
+// Add `color` to the Octree `weight` times (in raw uint32_t form)
+OCQ_EXPORT void OCQOctreeQuantizer_add_color_weighted(OCQOctreeQuantizer_t *self, uint32_t color, uint32_t weight) {
+    if (!self)
+        return;
+    
+    OCQColor_t ocq_color = OCQColor_from_raw(color);
+    OCQOctreeQuantizer_add_color(self, &ocq_color, weight);
+}
+
+// Add `count` colors to the Octree (in raw uint32_t form), inserting each distinct color once with its count
+// Colors are counted a chunk at a time in a small hash table and inserted in the order they first appear
+OCQ_EXPORT void OCQOctreeQuantizer_add_colors_raw(OCQOctreeQuantizer_t *self, const uint32_t *colors, size_t count) {
+    if (!self || !colors)
+        return;
+    
+    // Slot table (index + 1 into the unique colors, 0 is empty), unique colors, and their counts
+    uint32_t *slots = malloc(OCQ_BULK_SLOTS * sizeof(uint32_t) + OCQ_BULK_CHUNK * 2 * sizeof(uint32_t));
+    if (!slots) {
+        for (size_t i = 0; i < count; i++)
+            OCQOctreeQuantizer_add_color_raw(self, colors[i]);
+        return;
+    }
+    uint32_t *uniques = slots + OCQ_BULK_SLOTS;
+    uint32_t *counts = uniques + OCQ_BULK_CHUNK;
+    
+    for (size_t start = 0; start < count; start += OCQ_BULK_CHUNK) {
+        size_t end = count - start < OCQ_BULK_CHUNK ? count : start + OCQ_BULK_CHUNK;
+        memset(slots, 0, OCQ_BULK_SLOTS * sizeof(uint32_t));
+        
+        uint32_t unique_count = 0;
+        for (size_t i = start; i < end; i++) {
+            // Runs of the same color skip the hash entirely
+            if (unique_count && colors[i] == uniques[unique_count - 1]) {
+                counts[unique_count - 1]++;
+                continue;
+            }
+            
+            uint32_t slot = ((colors[i] * UINT32_C(0x9E3779B1)) >> 16) & (OCQ_BULK_SLOTS - 1);
+            while (slots[slot] && uniques[slots[slot] - 1] != colors[i])
+                slot = (slot + 1) & (OCQ_BULK_SLOTS - 1);
+            if (slots[slot])
+                counts[slots[slot] - 1]++;
+            else {
+                uniques[unique_count] = colors[i];
+                counts[unique_count] = 1;
+                slots[slot] = ++unique_count;
+            }
+        }
+        
+        for (uint32_t i = 0; i < unique_count; i++)
+            OCQOctreeQuantizer_add_color_weighted(self, uniques[i], counts[i]);
+    }
+    free(slots);
+}
+
+// Add the counts and sums accumulated by `src` into `dst`
+// Each leaf of `src` is added along the path of its average color, which every color under it shares, so trees built
+// over parts of an image merge into the tree of the whole image, reduced where `dst` has been reduced
+OCQ_EXPORT void OCQOctreeQuantizer_merge(OCQOctreeQuantizer_t *dst, const OCQOctreeQuantizer_t *src) {
+    if (!dst || !src || dst == src || !OCQOctreeNode_is_live(src->root, src))
+        return;
+    
+    uint32_t *stack = NULL;
+    arrput(stack, src->root);
+    while (arrlenu(stack)) {
+        const OCQOctreeNode_t *node = OCQOctreeNodeArena_get(&src->arena, arrpop(stack));
+        if (node->pixel_count > 0) {
+            // Aliased leaves already have their pixels in their sibling
+            if (node->alias)
+                continue;
+            
+            OCQColor_t color = {
+                .red = (int32_t) (node->color.red / node->pixel_count),
+                .green = (int32_t) (node->color.green / node->pixel_count),
+                .blue = (int32_t) (node->color.blue / node->pixel_count),
+                .alpha = (int32_t) (node->color.alpha / node->pixel_count)
+            };
+            OCQOctreeNode_add_sum(dst->root, &color, &node->color, node->pixel_count, 0, dst);
+            while (dst->leaf_cap && dst->leaf_count > dst->leaf_cap && OCQOctreeQuantizer_reduce_deepest(dst));
+            continue;
+        }
+        
+        for (int32_t i = (int32_t) src->child_count - 1; i >= 0; i--)
+            if (node->children[i])
+                arrput(stack, node->children[i]);
+    }
+    arrfree(stack);
+}
+
+// Push `node` onto the reduction heap, keyed on the pixels under it
+static void OCQReduceHeap_push(OCQReduceEntry_t **heap, OCQOctreeQuantizer_t *owner, uint32_t node) {
+    OCQOctreeNode_t *parent = OCQOctreeNodeArena_get(&owner->arena, node);
+    OCQReduceEntry_t entry = { 0, node };
+    for (uint32_t i = 0; i < owner->child_count; i++)
+        if (parent->children[i])
+            entry.pixel_count += OCQOctreeNodeArena_get(&owner->arena, parent->children[i])->pixel_count;
+    
+    size_t i = arrlenu(*heap);
+    arrput(*heap, entry);
+    while (i) {
+        size_t up = (i - 1) / 2;
+        if (!OCQReduceEntry_less(&(*heap)[i], &(*heap)[up]))
+            break;
+        OCQReduceEntry_t tmp = (*heap)[up];
+        (*heap)[up] = (*heap)[i];
+        (*heap)[i] = tmp;
+        i = up;
+    }
+}
+
+// Pop the node with the fewest pixels under it off the reduction heap
+static uint32_t OCQReduceHeap_pop(OCQReduceEntry_t *heap) {
+    uint32_t node = heap[0].node;
+    heap[0] = arrpop(heap);
+    size_t len = arrlenu(heap);
+    size_t i = 0;
+    while (true) {
+        size_t min = i;
+        size_t l = i * 2 + 1;
+        size_t r = l + 1;
+        if (l < len && OCQReduceEntry_less(&heap[l], &heap[min]))
+            min = l;
+        if (r < len && OCQReduceEntry_less(&heap[r], &heap[min]))
+            min = r;
+        if (min == i)
+            break;
+        OCQReduceEntry_t tmp = heap[min];
+        heap[min] = heap[i];
+        heap[i] = tmp;
+        i = min;
+    }
+    return node;
+}
+
+// Merge the leaves of `self` into it, freeing them for reuse
+static void OCQOctreeNode_merge_leaves(uint32_t self, OCQOctreeQuantizer_t *owner) {
+    OCQOctreeNode_t *node = OCQOctreeNodeArena_get(&owner->arena, self);
+    for (uint32_t i = 0; i < owner->child_count; i++) {
+        uint32_t child = node->children[i];
+        if (child) {
+            OCQOctreeNode_t *leaf = OCQOctreeNodeArena_get(&owner->arena, child);
+            node->color.red += leaf->color.red;
+            node->color.green += leaf->color.green;
+            node->color.blue += leaf->color.blue;
+            node->color.alpha += leaf->color.alpha;
+            node->pixel_count += leaf->pixel_count;
+            node->children[i] = 0;
+            OCQOctreeNode_release(child, owner);
+            owner->leaf_count--;
+        }
+    }
+    owner->leaf_count++;
+}
+
+// Merge the `count` smallest leaves of `self` into the next smallest one, keeping them in the tree as aliases
+static void OCQOctreeNode_merge_smallest_leaves(uint32_t self, size_t count, OCQOctreeQuantizer_t *owner) {
+    OCQOctreeNode_t *node = OCQOctreeNodeArena_get(&owner->arena, self);
+    
+    // Order the leaves by pixel count, then by index
+    OCQReduceEntry_t leaves[OCQ_CHILDREN_RGBA];
+    size_t leaf_count = 0;
+    for (uint32_t i = 0; i < owner->child_count; i++) {
+        if (node->children[i]) {
+            OCQReduceEntry_t entry = {
+                OCQOctreeNodeArena_get(&owner->arena, node->children[i])->pixel_count,
+                node->children[i]
+            };
+            size_t j = leaf_count++;
+            for (; j && OCQReduceEntry_less(&entry, &leaves[j - 1]); j--)
+                leaves[j] = leaves[j - 1];
+            leaves[j] = entry;
+        }
+    }
+    if (count >= leaf_count)
+        return;
     
-    OCQOctreeQuantizer_add_color(self, self->tmp_color);
+    OCQOctreeNode_t *target = OCQOctreeNodeArena_get(&owner->arena, leaves[count].node);
+    for (size_t i = 0; i < count; i++) {
+        OCQOctreeNode_t *leaf = OCQOctreeNodeArena_get(&owner->arena, leaves[i].node);
+        target->color.red += leaf->color.red;
+        target->color.green += leaf->color.green;
+        target->color.blue += leaf->color.blue;
+        target->color.alpha += leaf->color.alpha;
+        target->pixel_count += leaf->pixel_count;
+        leaf->alias = leaves[count].node;
+        owner->leaf_count--;
+    }
 }
 
 // Make color palette with `color_count` colors maximum
+// Nodes whose children are all leaves are reduced fewest pixels first, until exactly `color_count` leaves remain
 static OCQColorArray_t *OCQOctreeQuantizer_make_palette(OCQOctreeQuantizer_t *self, size_t color_count) {
     if (!self || !color_count || color_count > 65536)
         return NULL;
     
-    OCQOctreeNodeArray_t *leaf_nodes = OCQOctreeQuantizer_get_leaves(self);
-    size_t leaf_count = arrlenu(leaf_nodes->arr);
-    OCQOctreeNodeArray_free(leaf_nodes);
+    if (self->stats)
+        self->stats->leaves_before_reduction += self->leaf_count;
     
     // reduce nodes
-    // up to 16 leaves can be reduced here and the palette will have
-    // only 248 colors (in worst case) instead of expected 256 colors
-    for (int32_t level = OCQ_MAX_DEPTH - 1; level >= 0; level--) {
-        if (self->levels[level] && self->levels[level]->arr) {
-            for (size_t i = 0; i < arrlenu(self->levels[level]->arr); i++) {
-                OCQOctreeNode_t *node = self->levels[level]->arr[i];
-                leaf_count -= OCQOctreeNode_remove_leaves(node, self);
-                if (leaf_count <= color_count)
-                    break;
+    if (self->leaf_count > color_count) {
+        // Number of children of each inner node that are not leaves yet
+        uint8_t *pending = calloc(self->arena.count, sizeof(uint8_t));
+        if (!pending)
+            return NULL;
+        
+        OCQOctreeNodeArray_t *inner = OCQOctreeNodeArray___init__();
+        for (int32_t level = 0; level < self->max_depth; level++) {
+            for (size_t i = 0; self->levels[level] && i < arrlenu(self->levels[level]->arr); i++) {
+                uint32_t index = self->levels[level]->arr[i];
+                OCQOctreeNode_t *node = OCQOctreeNodeArena_get(&self->arena, index);
+                if (node->pixel_count > 0)
+                    continue;
+                
+                arrput(inner->arr, index);
+                for (uint32_t c = 0; c < self->child_count; c++)
+                    if (node->children[c] && OCQOctreeNodeArena_get(&self->arena, node->children[c])->pixel_count <= 0)
+                        pending[index]++;
             }
-            if (leaf_count <= color_count)
+        }
+        
+        OCQReduceEntry_t *heap = NULL;
+        for (size_t i = 0; i < arrlenu(inner->arr); i++)
+            if (!pending[inner->arr[i]])
+                OCQReduceHeap_push(&heap, self, inner->arr[i]);
+        OCQOctreeNodeArray_free(inner);
+        
+        while (self->leaf_count > color_count && arrlenu(heap)) {
+            uint32_t index = OCQReduceHeap_pop(heap);
+            OCQOctreeNode_t *node = OCQOctreeNodeArena_get(&self->arena, index);
+            
+            size_t child_count = 0;
+            for (uint32_t i = 0; i < self->child_count; i++)
+                if (node->children[i])
+                    child_count++;
+            
+            // Merge only as many siblings as needed when merging them all would go under `color_count`
+            if (self->leaf_count - (child_count - 1) < color_count) {
+                OCQOctreeNode_merge_smallest_leaves(index, self->leaf_count - color_count, self);
                 break;
-            OCQOctreeNodeArray_free(self->levels[level]);
-            self->levels[level] = NULL;
+            }
+            
+            OCQOctreeNode_merge_leaves(index, self);
+            if (self->stats)
+                self->stats->reductions[OCQOctreeNode_get_level(index, self)]++;
+            if (node->parent != UINT32_MAX && !--pending[node->parent])
+                OCQReduceHeap_push(&heap, self, node->parent);
         }
+        arrfree(heap);
+        free(pending);
     }
+    if (self->stats)
+        self->stats->leaves_after_reduction += self->leaf_count;
     
     // build palette
     OCQColorArray_t *palette = OCQColorArray___init__();
-    leaf_nodes = OCQOctreeQuantizer_get_leaves(self);
+    OCQOctreeNodeArray_t *leaf_nodes = OCQOctreeQuantizer_get_leaves(self);
     size_t palette_index = 0;
     for (size_t i = 0; i < arrlenu(leaf_nodes->arr); i++) {
-        OCQOctreeNode_t *node = leaf_nodes->arr[i];
-        if (palette_index >= color_count)
-            break;
-        if (OCQOctreeNode_is_leaf(node, self))
-            arrput(palette->arr, OCQOctreeNode_get_color(node, self));
+        OCQOctreeNode_t *node = OCQOctreeNodeArena_get(&self->arena, leaf_nodes->arr[i]);
+        if (node->alias || palette_index >= color_count)
+            continue;
+        arrput(palette->arr, OCQOctreeNode_get_color(leaf_nodes->arr[i], self));
         node->palette_index = palette_index++;
     }
+    for (size_t i = 0; i < arrlenu(leaf_nodes->arr); i++) {
+        OCQOctreeNode_t *node = OCQOctreeNodeArena_get(&self->arena, leaf_nodes->arr[i]);
+        if (node->alias)
+            node->palette_index = OCQOctreeNodeArena_get(&self->arena, node->alias)->palette_index;
+    }
     OCQOctreeNodeArray_free(leaf_nodes);
     return palette;
 }
@@ -422,23 +795,24 @@ size_t *out_size) {
     *out_size = 0;
     
     OCQColorArray_t *ocq_palette = OCQOctreeQuantizer_make_palette(self, color_count);
+    if (!ocq_palette)
+        return;
     size_t ocq_palette_size = arrlenu(ocq_palette->arr);
     *out_size = ocq_palette_size;
     for (size_t i = 0; i < ocq_palette_size; i++) {
-        OCQColor_t *color = ocq_palette->arr[i];
+        OCQColor_t *color = &ocq_palette->arr[i];
         palette[i] = (
               (((uint32_t) Math_ClampS32(color->red, 0, 255))   << OCQ_COMP_SH_R)
             | (((uint32_t) Math_ClampS32(color->green, 0, 255)) << OCQ_COMP_SH_G)
             | (((uint32_t) Math_ClampS32(color->blue, 0, 255))  << OCQ_COMP_SH_B)
             | (((uint32_t) Math_ClampS32(color->alpha, 0, 255)) << OCQ_COMP_SH_A)
         );
-        OCQColor_free(color);
     }
     OCQColorArray_free(ocq_palette);
 }
 
 // Get palette index for `color`
-static size_t OCQOctreeQuantizer_get_palette_index(OCQOctreeQuantizer_t *self, OCQColor_t *color) {
+static size_t OCQOctreeQuantizer_get_palette_index(const OCQOctreeQuantizer_t *self, const OCQColor_t *color) {
     if (!self || !color)
         return 0;
     
@@ -446,14 +820,129 @@ static size_t OCQOctreeQuantizer_get_palette_index(OCQOctreeQuantizer_t *self, O
 }
 
 // Get palette index for `color` (in raw size_t form)
-OCQ_EXPORT size_t OCQOctreeQuantizer_get_palette_index_raw(OCQOctreeQuantizer_t *self, uint32_t color) {
-    if (!self || !color)
+OCQ_EXPORT size_t OCQOctreeQuantizer_get_palette_index_raw(const OCQOctreeQuantizer_t *self, uint32_t color) {
+    if (!self)
+        return 0;
+    
+    if (self->stats)
+        self->stats->lookups++;
+    OCQColor_t ocq_color = OCQColor_from_raw(color);
+    return OCQOctreeQuantizer_get_palette_index(self, &ocq_color);
+}
+
+// Get palette index for `color` (in raw size_t form), reusing the last lookup in `cache` for runs of the same color
+OCQ_EXPORT size_t OCQOctreeQuantizer_get_palette_index_cached(const OCQOctreeQuantizer_t *self,
+OCQLookupCache_t *cache, uint32_t color) {
+    if (!self || !cache)
         return 0;
     
-    self->tmp_color->red = (color >> OCQ_COMP_SH_R) & 0xFF;
-    self->tmp_color->green = (color >> OCQ_COMP_SH_G) & 0xFF;
-    self->tmp_color->blue = (color >> OCQ_COMP_SH_B) & 0xFF;
-    self->tmp_color->alpha = (color >> OCQ_COMP_SH_A) & 0xFF;
+    if (!cache->valid || cache->color != color) {
+        cache->color = color;
+        cache->palette_index = OCQOctreeQuantizer_get_palette_index_raw(self, color);
+        cache->valid = true;
+    } else if (self->stats)
+        self->stats->lookups++;
+    return cache->palette_index;
+}
+
+// Freeze the lookup tree of `self`, call after making the palette
+OCQ_EXPORT OCQFrozenPalette_t *OCQOctreeQuantizer_freeze(const OCQOctreeQuantizer_t *self) {
+    if (!self || !OCQOctreeNode_is_live(self->root, self))
+        return NULL;
     
-    return OCQOctreeQuantizer_get_palette_index(self, self->tmp_color);
+    OCQFrozenPalette_t *frozen = malloc(sizeof(OCQFrozenPalette_t));
+    if (!frozen)
+        return NULL;
+    frozen->node_count = 0;
+    frozen->child_count = self->child_count;
+    frozen->nodes = NULL;
+    frozen->children = NULL;
+    
+    // Copy nodes down to the leaves, children of leaves are never reached by a lookup
+    // Pairs of (source node, frozen node)
+    uint32_t *stack = NULL;
+    arrput(frozen->nodes, (OCQFrozenNode_t) { 0 });
+    arrsetlen(frozen->children, frozen->child_count);
+    memset(frozen->children, 0, frozen->child_count * sizeof(uint32_t));
+    arrput(stack, self->root);
+    arrput(stack, 0);
+    while (arrlenu(stack)) {
+        uint32_t dst = arrpop(stack);
+        uint32_t src = arrpop(stack);
+        const OCQOctreeNode_t *node = OCQOctreeNodeArena_get(&self->arena, src);
+        
+        frozen->nodes[dst].is_leaf = node->pixel_count > 0;
+        frozen->nodes[dst].palette_index = node->palette_index;
+        if (frozen->nodes[dst].is_leaf)
+            continue;
+        
+        for (uint32_t i = 0; i < frozen->child_count; i++) {
+            if (node->children[i]) {
+                uint32_t child = (uint32_t) arrlenu(frozen->nodes);
+                arrput(frozen->nodes, (OCQFrozenNode_t) { 0 });
+                for (uint32_t c = 0; c < frozen->child_count; c++)
+                    arrput(frozen->children, 0);
+                frozen->children[dst * frozen->child_count + i] = child;
+                arrput(stack, node->children[i]);
+                arrput(stack, child);
+            }
+        }
+    }
+    arrfree(stack);
+    
+    frozen->node_count = arrlenu(frozen->nodes);
+    return frozen;
+}
+
+// Free Frozen Palette
+OCQ_EXPORT void OCQFrozenPalette_free(OCQFrozenPalette_t *self) {
+    if (!self)
+        return;
+    
+    arrfree(self->nodes);
+    arrfree(self->children);
+    free(self);
+}
+
+// Get palette index for `color` (in raw size_t form)
+// Follows the same path as OCQOctreeNode_get_palette_index on the quantizer it was frozen from
+OCQ_EXPORT size_t OCQFrozenPalette_get_palette_index_raw(const OCQFrozenPalette_t *self, uint32_t color) {
+    if (!self || !self->node_count)
+        return 0;
+    
+    OCQColor_t ocq_color = OCQColor_from_raw(color);
+    uint32_t node = 0;
+    int32_t level = 0;
+    while (!self->nodes[node].is_leaf) {
+        const uint32_t *children = &self->children[node * self->child_count];
+        uint32_t newNode = children[get_color_index_for_level(&ocq_color, level, self->child_count)];
+        if (!newNode) {
+            // get palette index for the last found child node
+            for (int32_t i = (int32_t) self->child_count - 1; i >= 0 && !newNode; i--)
+                newNode = children[i];
+            if (!newNode)
+                return SIZE_MAX;
+        }
+        node = newNode;
+        level++;
+    }
+    return self->nodes[node].palette_index;
+}
+
+// Map `count` raw colors to their palette indices
+OCQ_EXPORT void OCQFrozenPalette_map_raw(const OCQFrozenPalette_t *self, size_t count, const uint32_t *colors,
+uint32_t *indices) {
+    if (!self || !colors || !indices)
+        return;
+    
+    // Runs of the same color are common, reuse the last lookup for them
+    uint32_t last_color = 0;
+    uint32_t last_index = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!i || colors[i] != last_color) {
+            last_color = colors[i];
+            last_index = (uint32_t) OCQFrozenPalette_get_palette_index_raw(self, last_color);
+        }
+        indices[i] = last_index;
+    }
 }
@@ -377,6 +377,8 @@ typedef struct TGA {
     uint32_t *data;
     bool isNewFmt;
     TGAFileFooter_t ftr;
+    size_t mapSz;
+    uint8_t *map; /* Mapping of the file opened by TGA_OpenFile, NULL otherwise */
 } TGA_t;
 
 #ifdef TGA_INCLUDE_DECODE
@@ -392,7 +394,8 @@ typedef enum TGAReadError {
     TGA_RE_INVLDPXLDEP,
     TGA_RE_INVLDALPHBITSZ,
     TGA_RE_MEMFAILID,
-    TGA_RE_MEMFAILDATA
+    TGA_RE_MEMFAILDATA,
+    TGA_RE_MAPFAILFILE
 } TGAReadError_t;
 #endif
 
@@ -422,6 +425,12 @@ TGA_EXPORT bool TGA_IsNewFormat(size_t dataSz, uint8_t *data);
 #ifdef TGA_INCLUDE_DECODE
 TGA_EXPORT TGAReadError_t TGA_Read(TGA_t *tga, size_t dataSz, uint8_t *data);
 
+// Map the file at `path` read-only and read it like TGA_Read, the mapping stays until TGA_CloseFile
+TGA_EXPORT TGAReadError_t TGA_OpenFile(TGA_t *tga, const char *path);
+
+// Unmap the file of a TGA opened by TGA_OpenFile and free it, TGA_free leaves the mapping
+TGA_EXPORT void TGA_CloseFile(TGA_t *tga);
+
 TGA_EXPORT char *TGAReadError_ToStr(TGAReadError_t tgaReadError);
 #endif
 
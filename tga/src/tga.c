@@ -27,6 +27,7 @@
 #include <stdext/cdata.h>
 #include <stdext/catexit.h>
 #include <stdext/cmath.h>
+#include <filemap.h>
 
 TGA_EXPORT void TGA_free(TGA_t *tga) {
     free(tga->id);
@@ -41,6 +42,9 @@ TGA_EXPORT bool TGA_IsNewFormat(size_t dataSz, uint8_t *data) {
 
 #ifdef TGA_INCLUDE_DECODE
 TGAReadError_t TGA_Read(TGA_t *tga, size_t dataSz, uint8_t *data) {
+    if (tga)
+        tga->map = NULL;
+    
     if (!tga || !dataSz || !data)
         return TGA_RE_INVLDPARAMS;
     
@@ -151,6 +155,40 @@ TGAReadError_t TGA_Read(TGA_t *tga, size_t dataSz, uint8_t *data) {
     return TGA_RE_SUCCESS;
 }
 
+TGAReadError_t TGA_OpenFile(TGA_t *tga, const char *path) {
+    if (tga)
+        tga->map = NULL;
+    
+    if (!tga || !path)
+        return TGA_RE_INVLDPARAMS;
+    
+    size_t mapSz;
+    uint8_t *map = FileMap_Open(path, &mapSz);
+    if (!map)
+        return TGA_RE_MAPFAILFILE;
+    
+    TGAReadError_t readErr = TGA_Read(tga, mapSz, map);
+    if (readErr != TGA_RE_SUCCESS) {
+        FileMap_Close(map, mapSz);
+        return readErr;
+    }
+    tga->mapSz = mapSz;
+    tga->map = map;
+    
+    return TGA_RE_SUCCESS;
+}
+
+void TGA_CloseFile(TGA_t *tga) {
+    if (!tga)
+        return;
+    
+    if (tga->map)
+        FileMap_Close(tga->map, tga->mapSz);
+    tga->map = NULL;
+    tga->mapSz = 0;
+    TGA_free(tga);
+}
+
 char *TGAReadError_ToStr(TGAReadError_t tgaReadError) {
     switch (tgaReadError) {
         case TGA_RE_SUCCESS:
@@ -223,6 +261,12 @@ char *TGAReadError_ToStr(TGAReadError_t tgaReadError) {
             return "TGA_RE_MEMFAILDATA"
 #ifdef TGA_INCLUDE_ERROR_STRINGS
                 ": Failed to allocate memory for data."
+#endif
+            ;
+        case TGA_RE_MAPFAILFILE:
+            return "TGA_RE_MAPFAILFILE"
+#ifdef TGA_INCLUDE_ERROR_STRINGS
+                ": Failed to open and map the file."
 #endif
             ;
         default:
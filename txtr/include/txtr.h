@@ -112,6 +112,14 @@ typedef struct TXTRPaletteHeader {
     uint16_t height;
 } ALIGN TXTRPaletteHeader_t;
 
+// Not a literal data structure that maps to a data format --- for API use only!
+typedef struct TXTRMipInfo {
+    size_t offset; /* Into `mips` */
+    size_t size; /* Cut short when `mips` ends before the mip does */
+    uint16_t width;
+    uint16_t height;
+} TXTRMipInfo_t;
+
 // Not a literal data structure that maps to a data format --- for API use only!
 typedef struct TXTR {
     TXTRHeader_t hdr;
@@ -120,9 +128,15 @@ typedef struct TXTR {
     uint16_t *pal;
     size_t mipsSz;
     uint8_t *mips;
+    TXTRMipInfo_t mipInfo[11]; /* Where each of the `hdr.mipCount` mips lies in `mips`, filled by the readers */
     bool isIndexed;
+    bool borrowed; /* Set when `pal` and `mips` point into the buffer read from, TXTR_free only clears them */
+    size_t mapSz;
+    uint8_t *map; /* Mapping of the file opened by TXTR_OpenFile, NULL otherwise */
 } TXTR_t;
 
+// Release a TXTR from any reader: frees what TXTR_Read and TXTR_Encode allocated, unmaps files from TXTR_OpenFile
+// and only clears views from TXTR_ReadView, whose buffer stays with the caller. `pal` and `mips` are NULL afterwards
 TXTR_EXPORT void TXTR_free(TXTR_t *txtr);
 
 TXTR_EXPORT bool TXTR_IsIndexed(TXTRFormat_t texFmt);
@@ -135,7 +149,14 @@ TXTR_EXPORT size_t TXTR_GetMaxPalSz(TXTRFormat_t texFmt);
 typedef struct TXTRDecodeOptions {
     bool flipX;
     bool flipY;
-    bool decAllMips;
+    bool decAllMips; /* Decode from `firstMip` through the last mip */
+    uint8_t firstMip; /* First mip to decode into `mipsOut[0]` */
+    uint8_t lastMip; /* Last mip to decode, only `firstMip` when not above it */
+    uint16_t maxDim; /* Start from the largest mip no wider or taller than this instead of `firstMip`, 0 to not */
+    bool contiguous; /* Decode every mip into one allocation, freed along with the first mip */
+    size_t outBufSz;
+    uint32_t *outBuf; /* Decode every mip into this buffer of TXTR_CalcDecodeSz pixels instead, NULL to allocate */
+    bool parallel; /* Decode the mips on multiple threads when txtr is built with OpenMP */
 } TXTRDecodeOptions_t;
 
 // Not a literal data structure that maps to a data format --- for API use only!
@@ -144,8 +165,22 @@ typedef struct TXTRMipmap {
     uint16_t height;
     size_t size;
     uint32_t *data; /* To get actual size: dataSz * sizeof(uint32_t) */
+    bool borrowed; /* Set when `data` is part of a buffer owned by another mip or the caller */
 } TXTRMipmap_t;
 
+// Not a literal data structure that maps to a data format --- for API use only!
+typedef struct TXTRInfo {
+    TXTRHeader_t hdr;
+    TXTRPaletteHeader_t palHdr;
+    bool isIndexed;
+    size_t palSz; /* Colors in the palette, 0 when not indexed */
+    size_t mipsSz; /* Mip data following the headers */
+    size_t calcMipsSz; /* Sum of TXTR_CalcMipSz over every mip, `mipsSz` may be longer */
+    TXTRMipInfo_t mipInfo[11];
+    size_t decMipSz[11]; /* Bytes TXTR_Decode allocates for each mip */
+    size_t decSz; /* Bytes TXTR_Decode allocates for every mip and the palette together */
+} TXTRInfo_t;
+
 typedef enum TXTRReadError {
     TXTR_RE_SUCCESS = 0,
     TXTR_RE_INVLDPARAMS,
@@ -158,7 +193,9 @@ typedef enum TXTRReadError {
     TXTR_RE_INVLDPALHEIGHT,
     TXTR_RE_INVLDPALSZ,
     TXTR_RE_MEMFAILPAL,
-    TXTR_RE_MEMFAILMIPS
+    TXTR_RE_MEMFAILMIPS,
+    TXTR_RE_MAPFAILFILE,
+    TXTR_RE_INVLDDATASZ
 } TXTRReadError_t;
 
 typedef enum TXTRDecodeError {
@@ -174,13 +211,36 @@ typedef enum TXTRDecodeError {
     TXTR_DE_MEMFAILPAL,
     TXTR_DE_MEMFAILMIP,
     TXTR_DE_INTERRUPTED,
-    TXTR_DE_FAILDECPAL
+    TXTR_DE_FAILDECPAL,
+    TXTR_DE_INVLDMIPRANGE,
+    TXTR_DE_INVLDOUTBUFSZ
 } TXTRDecodeError_t;
 
 TXTR_EXPORT void TXTRMipmap_free(TXTRMipmap_t *mip);
 
 TXTR_EXPORT TXTRReadError_t TXTR_Read(TXTR_t *txtr, size_t dataSz, uint8_t *data);
 
+// Read like TXTR_Read, but point `pal` and `mips` into `data` instead of copying them out
+// `data` must outlive `txtr` and stay 2 byte aligned, the palette is still stored big endian like with TXTR_Read
+TXTR_EXPORT TXTRReadError_t TXTR_ReadView(TXTR_t *txtr, size_t dataSz, uint8_t *data);
+
+// Map the file at `path` read-only and read it like TXTR_ReadView, the mapping stays until TXTR_free or TXTR_CloseFile
+TXTR_EXPORT TXTRReadError_t TXTR_OpenFile(TXTR_t *txtr, const char *path);
+
+// Same as TXTR_free for a TXTR opened by TXTR_OpenFile, does nothing for any other
+TXTR_EXPORT void TXTR_CloseFile(TXTR_t *txtr);
+
+// Get the raw data of mip `level` of a read TXTR and its size, NULL if there is no such mip
+TXTR_EXPORT uint8_t *TXTR_GetMip(TXTR_t *txtr, uint32_t level, size_t *mipSz);
+
+// Parse only the headers of the TXTR in `data` and check that it holds every mip, without copying anything
+// Unlike the readers, mips cut short fail with TXTR_RE_INVLDDATASZ, `info` is still filled and `mipsSz` is then
+// less than `calcMipsSz`
+TXTR_EXPORT TXTRReadError_t TXTR_Probe(size_t dataSz, uint8_t *data, TXTRInfo_t *info);
+
+// Get the pixels TXTR_Decode decodes for `opts`, 0 for an invalid mip range
+TXTR_EXPORT size_t TXTR_CalcDecodeSz(TXTR_t *txtr, TXTRDecodeOptions_t *opts);
+
 TXTR_EXPORT TXTRDecodeError_t TXTR_Decode(TXTR_t *txtr, TXTRMipmap_t mipsOut[11], size_t *mipsOutCount,
 TXTRDecodeOptions_t *opts);
 
@@ -203,6 +263,15 @@ typedef struct TXTREncodeOptions {
     stbir_edge stbirEdge;
     stbir_filter stbirFilter;
     GXDitherType_t ditherType;
+    GXQuantizerType_t quantType;
+    size_t sampleBudget;
+    size_t octreeLeafCap;
+    uint8_t octreeDepth;
+    OCQOctreeQuantizer_t *octree;
+    OCQStats_t *octreeStats;
+    uint32_t kmeansIters;
+    double kmeansThreshold;
+    double kmeansTimeLimit;
 } TXTREncodeOptions_t;
 
 // Not a literal data structure that maps to a data format --- for API use only!
@@ -233,7 +302,10 @@ typedef enum TXTREncodeError {
     TXTR_EE_INTERRUPTED,
     TXTR_EE_FAILENCPAL,
     TXTR_EE_INVLDSQUISHMETRICSZ,
-    TXTR_EE_INVLDGXDITHERTYPE
+    TXTR_EE_INVLDGXDITHERTYPE,
+    TXTR_EE_INVLDGXQUANTTYPE,
+    TXTR_EE_INVLDKMEANSLIMITS,
+    TXTR_EE_INVLDOCTREEDEPTH
 } TXTREncodeError_t;
 
 typedef enum TXTRWriteError {
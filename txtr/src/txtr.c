@@ -30,11 +30,19 @@
 #include <stdext/cmath.h>
 #include <stdext/catexit.h>
 #include <stb_image_resize2.h>
+#include <filemap.h>
 
 TXTR_EXPORT void TXTR_free(TXTR_t *txtr) {
-    free(txtr->pal);
+    // Files opened by TXTR_OpenFile own their mapping, views read by TXTR_ReadView point into the caller's buffer
+    if (txtr->map) {
+        FileMap_Close(txtr->map, txtr->mapSz);
+        txtr->map = NULL;
+        txtr->mapSz = 0;
+    } else if (!txtr->borrowed) {
+        free(txtr->pal);
+        free(txtr->mips);
+    }
     txtr->pal = NULL;
-    free(txtr->mips);
     txtr->mips = NULL;
 }
 
@@ -86,20 +94,43 @@ TXTR_EXPORT size_t TXTR_GetMaxPalSz(TXTRFormat_t texFmt) {
 
 #ifdef TXTR_INCLUDE_DECODE
 TXTR_EXPORT void TXTRMipmap_free(TXTRMipmap_t *mip) {
-    free(mip->data);
+    // Mips decoded into one buffer share the first mip's, or the caller's
+    if (!mip->borrowed)
+        free(mip->data);
     mip->data = NULL;
 }
 
-TXTR_EXPORT TXTRReadError_t TXTR_Read(TXTR_t *txtr, size_t dataSz, uint8_t *data) {
-    if (txtr) {
-        txtr->pal = NULL;
-        txtr->mips = NULL;
+// Lay out the mips of `txtr` in `mips` from the sizes its format gives them, returns the size of all of them
+static size_t TXTR_CalcMipInfo(const TXTR_t *txtr, TXTRMipInfo_t mipInfo[11]) {
+    size_t offset = 0;
+    uint16_t mipWidth = txtr->hdr.width;
+    uint16_t mipHeight = txtr->hdr.height;
+    for (size_t m = 0; m < txtr->hdr.mipCount; m++) {
+        size_t mipSz = TXTR_CalcMipSz(txtr->hdr.format, mipWidth, mipHeight);
+        size_t mipsSzRem = offset < txtr->mipsSz ? txtr->mipsSz - offset : 0;
+        mipInfo[m].offset = offset < txtr->mipsSz ? offset : txtr->mipsSz;
+        mipInfo[m].size = mipSz < mipsSzRem ? mipSz : mipsSzRem;
+        mipInfo[m].width = mipWidth;
+        mipInfo[m].height = mipHeight;
+        
+        offset += mipSz;
+        mipWidth /= 2;
+        mipHeight /= 2;
     }
+    return offset;
+}
+
+// Read the texture and palette headers of the TXTR in `data` into `txtr` and lay out the mips following them
+// `*palPtr` is set to where the palette (or the mips when not indexed) starts
+// Every reader goes through here, so they all agree on which data is valid
+static TXTRReadError_t TXTR_ReadLayout(TXTR_t *txtr, size_t dataSz, uint8_t *data, uint8_t **palPtr) {
+    // Sizes as stored in the file, not of the padded structures
+    // Even unindexed textures hold more than a palette header in their smallest mip
+    size_t hdrSz = 2 * sizeof(uint32_t) + 2 * sizeof(uint16_t);
+    size_t palHdrSz = sizeof(uint32_t) + 2 * sizeof(uint16_t);
+    if (dataSz < hdrSz + palHdrSz)
+        return TXTR_RE_INVLDDATASZ;
     
-    if (!txtr || !dataSz || !data)
-        return TXTR_RE_INVLDPARAMS;
-    
-    uint8_t *dEndPtr = data + dataSz;
     uint8_t *dPtr = data;
     
     txtr->hdr.format = (TXTRFormat_t) Dat_GetU32BE(dPtr);
@@ -143,6 +174,39 @@ TXTR_EXPORT TXTRReadError_t TXTR_Read(TXTR_t *txtr, size_t dataSz, uint8_t *data
         if (txtr->palSz > TXTR_GetMaxPalSz(txtr->hdr.format))
             return TXTR_RE_INVLDPALSZ;
         
+        if (txtr->palSz * sizeof(uint16_t) > dataSz - (hdrSz + palHdrSz))
+            return TXTR_RE_INVLDDATASZ;
+    } else
+        txtr->palSz = 0;
+    *palPtr = dPtr;
+    
+    // Although GX_CalcMipSz can be used here, it may fail in certain cases such as I8 textures, where Retro had a bug
+    // in their TXTR cooker. So the mips take the rest of the data, and mips cut short are padded when decoding.
+    txtr->mipsSz = dataSz - (size_t) (((uintptr_t) dPtr) - ((uintptr_t) data)) - txtr->palSz * sizeof(uint16_t);
+    TXTR_CalcMipInfo(txtr, txtr->mipInfo);
+    
+    return TXTR_RE_SUCCESS;
+}
+
+
+TXTR_EXPORT TXTRReadError_t TXTR_Read(TXTR_t *txtr, size_t dataSz, uint8_t *data) {
+    if (txtr) {
+        txtr->pal = NULL;
+        txtr->mips = NULL;
+        txtr->borrowed = false;
+        txtr->map = NULL;
+    }
+    
+    if (!txtr || !dataSz || !data)
+        return TXTR_RE_INVLDPARAMS;
+    
+    uint8_t *dPtr;
+    
+    TXTRReadError_t layoutErr = TXTR_ReadLayout(txtr, dataSz, data, &dPtr);
+    if (layoutErr != TXTR_RE_SUCCESS)
+        return layoutErr;
+    
+    if (txtr->isIndexed) {
         size_t aPalSz = txtr->palSz * sizeof(uint16_t);
         txtr->pal = malloc(aPalSz);
         if (!txtr->pal) {
@@ -151,14 +215,8 @@ TXTR_EXPORT TXTRReadError_t TXTR_Read(TXTR_t *txtr, size_t dataSz, uint8_t *data
         }
         memcpy(txtr->pal, dPtr, aPalSz);
         dPtr += aPalSz;
-    } else {
-        txtr->palSz = 0;
-        txtr->pal = NULL;
     }
     
-    // Although GX_CalcMipSz can be used here, it may fail in certain cases such as I8 textures, where Retro had a bug
-    // in their TXTR cooker.
-    txtr->mipsSz = (size_t) (((uintptr_t) dEndPtr) - ((uintptr_t) dPtr));
     txtr->mips = malloc(txtr->mipsSz);
     if (!txtr->mips) {
         if (txtr->isIndexed) {
@@ -174,6 +232,193 @@ TXTR_EXPORT TXTRReadError_t TXTR_Read(TXTR_t *txtr, size_t dataSz, uint8_t *data
     return TXTR_RE_SUCCESS;
 }
 
+TXTR_EXPORT TXTRReadError_t TXTR_ReadView(TXTR_t *txtr, size_t dataSz, uint8_t *data) {
+    if (txtr) {
+        txtr->pal = NULL;
+        txtr->mips = NULL;
+        txtr->borrowed = true;
+        txtr->map = NULL;
+    }
+    
+    if (!txtr || !dataSz || !data)
+        return TXTR_RE_INVLDPARAMS;
+    
+    uint8_t *dPtr;
+    
+    TXTRReadError_t layoutErr = TXTR_ReadLayout(txtr, dataSz, data, &dPtr);
+    if (layoutErr != TXTR_RE_SUCCESS)
+        return layoutErr;
+    
+    if (txtr->isIndexed) {
+        txtr->pal = (uint16_t *) dPtr;
+        dPtr += txtr->palSz * sizeof(uint16_t);
+    }
+    txtr->mips = dPtr;
+    
+    return TXTR_RE_SUCCESS;
+}
+
+TXTR_EXPORT TXTRReadError_t TXTR_OpenFile(TXTR_t *txtr, const char *path) {
+    if (txtr) {
+        txtr->pal = NULL;
+        txtr->mips = NULL;
+        txtr->borrowed = true;
+        txtr->map = NULL;
+    }
+    
+    if (!txtr || !path)
+        return TXTR_RE_INVLDPARAMS;
+    
+    size_t mapSz;
+    uint8_t *map = FileMap_Open(path, &mapSz);
+    if (!map)
+        return TXTR_RE_MAPFAILFILE;
+    
+    // TXTR_ReadView checks the headers and palette against `mapSz`, so files cut short there fail here
+    TXTRReadError_t readErr = TXTR_ReadView(txtr, mapSz, map);
+    if (readErr != TXTR_RE_SUCCESS) {
+        FileMap_Close(map, mapSz);
+        txtr->pal = NULL;
+        txtr->mips = NULL;
+        return readErr;
+    }
+    txtr->mapSz = mapSz;
+    txtr->map = map;
+    
+    return TXTR_RE_SUCCESS;
+}
+
+TXTR_EXPORT void TXTR_CloseFile(TXTR_t *txtr) {
+    if (!txtr || !txtr->map)
+        return;
+    
+    TXTR_free(txtr);
+}
+
+TXTR_EXPORT uint8_t *TXTR_GetMip(TXTR_t *txtr, uint32_t level, size_t *mipSz) {
+    if (!txtr || !txtr->mips || level >= txtr->hdr.mipCount || level >= 11 || !mipSz)
+        return NULL;
+    
+    *mipSz = txtr->mipInfo[level].size;
+    return txtr->mips + txtr->mipInfo[level].offset;
+}
+
+TXTR_EXPORT TXTRReadError_t TXTR_Probe(size_t dataSz, uint8_t *data, TXTRInfo_t *info) {
+    if (!dataSz || !data || !info)
+        return TXTR_RE_INVLDPARAMS;
+    
+    memset(info, 0, sizeof(TXTRInfo_t));
+    
+    TXTR_t txtr = { 0 };
+    uint8_t *dPtr;
+    TXTRReadError_t layoutErr = TXTR_ReadLayout(&txtr, dataSz, data, &dPtr);
+    info->hdr = txtr.hdr;
+    info->palHdr = txtr.palHdr;
+    info->isIndexed = txtr.isIndexed;
+    
+    // Data cut short is still described as far as it was laid out, anything else leaves the rest unread
+    if (layoutErr != TXTR_RE_SUCCESS && layoutErr != TXTR_RE_INVLDDATASZ)
+        return layoutErr;
+    
+    info->palSz = txtr.palSz;
+    info->mipsSz = txtr.mipsSz;
+    info->decSz = txtr.palSz * sizeof(uint32_t);
+    for (size_t m = 0; m < txtr.hdr.mipCount; m++) {
+        info->mipInfo[m] = txtr.mipInfo[m];
+        info->calcMipsSz += TXTR_CalcMipSz(txtr.hdr.format, txtr.mipInfo[m].width, txtr.mipInfo[m].height);
+        info->decMipSz[m] = (size_t) txtr.mipInfo[m].width * txtr.mipInfo[m].height * sizeof(uint32_t);
+        info->decSz += info->decMipSz[m];
+    }
+    
+    // The readers pad mips cut short when decoding, only probing tells the caller about them
+    if (layoutErr == TXTR_RE_SUCCESS && info->calcMipsSz > info->mipsSz)
+        return TXTR_RE_INVLDDATASZ;
+    
+    return layoutErr;
+}
+
+// Get the first and last mip of `txtr` laid out in `mipInfo` that `opts` asks to decode
+// Returns true when they are not mips of `txtr`
+static bool TXTR_GetMipRange(const TXTR_t *txtr, const TXTRMipInfo_t mipInfo[11], TXTRDecodeOptions_t *opts,
+size_t *firstMip, size_t *lastMip) {
+    *firstMip = opts->firstMip;
+    if (opts->maxDim) {
+        // Largest mip that fits, or the smallest one when none do
+        for (*firstMip = 0; *firstMip + 1 < txtr->hdr.mipCount; (*firstMip)++)
+            if (mipInfo[*firstMip].width <= opts->maxDim && mipInfo[*firstMip].height <= opts->maxDim)
+                break;
+    }
+    *lastMip = opts->decAllMips ? txtr->hdr.mipCount - 1 : (opts->lastMip > *firstMip ? opts->lastMip : *firstMip);
+    return *firstMip >= txtr->hdr.mipCount || *lastMip >= txtr->hdr.mipCount;
+}
+
+// Decode the mip of `txtr` at `mipInfo` into `mip`, laid out beforehand
+// Returns true when the format of `txtr` can not be decoded
+static bool TXTR_DecodeMip(const TXTR_t *txtr, const TXTRMipInfo_t *mipInfo, uint32_t *palette, TXTRMipmap_t *mip,
+GXDecodeOptions_t *gxOpts) {
+    uint8_t *mipsPtr = txtr->mips + mipInfo->offset;
+    size_t mipsSzRem = txtr->mipsSz - mipInfo->offset;
+    switch (txtr->hdr.format) {
+        case TXTR_TTF_I4:
+            GX_DecodeI4(mip->width, mip->height, mipsSzRem, mipsPtr, mip->size, mip->data, gxOpts);
+            break;
+        case TXTR_TTF_I8:
+            GX_DecodeI8(mip->width, mip->height, mipsSzRem, mipsPtr, mip->size, mip->data, gxOpts);
+            break;
+        case TXTR_TTF_IA4:
+            GX_DecodeIA4(mip->width, mip->height, mipsSzRem, mipsPtr, mip->size, mip->data, gxOpts);
+            break;
+        case TXTR_TTF_IA8:
+            GX_DecodeIA8(mip->width, mip->height, mipsSzRem, mipsPtr, mip->size, mip->data, gxOpts);
+            break;
+        case TXTR_TTF_CI4:
+            GX_DecodeCI4(mip->width, mip->height, mipsSzRem, mipsPtr, txtr->palSz, palette, mip->size,
+                mip->data, gxOpts);
+            break;
+        case TXTR_TTF_CI8:
+            GX_DecodeCI8(mip->width, mip->height, mipsSzRem, mipsPtr, txtr->palSz, palette, mip->size,
+                mip->data, gxOpts);
+            break;
+        case TXTR_TTF_CI14X2:
+            GX_DecodeCI14X2(mip->width, mip->height, mipsSzRem, mipsPtr, txtr->palSz, palette, mip->size,
+                mip->data, gxOpts);
+            break;
+        case TXTR_TTF_R5G6B5:
+            GX_DecodeR5G6B5(mip->width, mip->height, mipsSzRem, mipsPtr, mip->size, mip->data, gxOpts);
+            break;
+        case TXTR_TTF_RGB5A3:
+            GX_DecodeRGB5A3(mip->width, mip->height, mipsSzRem, mipsPtr, mip->size, mip->data, gxOpts);
+            break;
+        case TXTR_TTF_RGBA8:
+            GX_DecodeRGBA8(mip->width, mip->height, mipsSzRem, mipsPtr, mip->size, mip->data, gxOpts);
+            break;
+        case TXTR_TTF_CMP:
+            GX_DecodeCMP(mip->width, mip->height, mipsSzRem, mipsPtr, mip->size, mip->data, gxOpts);
+            break;
+        default:
+            return true;
+    }
+    return false;
+}
+
+TXTR_EXPORT size_t TXTR_CalcDecodeSz(TXTR_t *txtr, TXTRDecodeOptions_t *opts) {
+    if (!txtr || !opts || !txtr->hdr.mipCount || txtr->hdr.mipCount > 11)
+        return 0;
+    
+    TXTRMipInfo_t mipInfo[11];
+    TXTR_CalcMipInfo(txtr, mipInfo);
+    
+    size_t firstMip;
+    size_t lastMip;
+    if (TXTR_GetMipRange(txtr, mipInfo, opts, &firstMip, &lastMip))
+        return 0;
+    
+    size_t chainSz = 0;
+    for (size_t m = firstMip; m <= lastMip; m++)
+        chainSz += (size_t) mipInfo[m].width * mipInfo[m].height;
+    return chainSz;
+}
+
 TXTR_EXPORT TXTRDecodeError_t TXTR_Decode(TXTR_t *txtr, TXTRMipmap_t mipsOut[11], size_t *mipsOutCount,
 TXTRDecodeOptions_t *opts) {
     if (!txtr || !mipsOut || !mipsOutCount || !opts || (txtr->isIndexed && !TXTR_IsIndexed(txtr->hdr.format)))
@@ -200,6 +445,22 @@ TXTRDecodeOptions_t *opts) {
     if (txtr->isIndexed && (txtr->palHdr.format < TXTR_TPF_IA8 || txtr->palHdr.format > TXTR_TPF_RGB5A3))
         return TXTR_DE_INVLDPALFMT;
     
+    // Laid out here instead of read from `txtr->mipInfo`, which only the readers fill in
+    TXTRMipInfo_t mipInfo[11];
+    TXTR_CalcMipInfo(txtr, mipInfo);
+    
+    size_t firstMip;
+    size_t lastMip;
+    if (TXTR_GetMipRange(txtr, mipInfo, opts, &firstMip, &lastMip))
+        return TXTR_DE_INVLDMIPRANGE;
+    
+    // Pixels of every mip to decode, when decoding them all into one buffer
+    size_t chainSz = 0;
+    for (size_t m = firstMip; m <= lastMip; m++)
+        chainSz += (size_t) mipInfo[m].width * mipInfo[m].height;
+    if (opts->outBuf && opts->outBufSz < chainSz)
+        return TXTR_DE_INVLDOUTBUFSZ;
+    
     GXDecodeOptions_t gxOpts = {
         .flipX = opts->flipX,
         .flipY = opts->flipY
@@ -233,85 +494,65 @@ TXTRDecodeOptions_t *opts) {
         }
     }
     
-    uint8_t *mipsPtr = txtr->mips;
-    size_t mipsSzRem = txtr->mipsSz;
-    uint16_t mipWidth = txtr->hdr.width;
-    uint16_t mipHeight = txtr->hdr.height;
-    size_t m = 0;
-    for (size_t l = opts->decAllMips ? txtr->hdr.mipCount : 1; catexit_loopSafety && m < l; m++) {
-        size_t curOutSz = mipWidth * mipHeight;
-        size_t dataSz = curOutSz * sizeof(uint32_t);
-        mipsOut[m].width = mipWidth;
-        mipsOut[m].height = mipHeight;
+    // One buffer for every mip, owned by the first mip unless it is the caller's
+    uint32_t *chain = opts->outBuf;
+    if (!chain && opts->contiguous) {
+        chain = malloc(chainSz * sizeof(uint32_t));
+        if (!chain) {
+            free(palette);
+            return TXTR_DE_MEMFAILMIP;
+        }
+    }
+    size_t chainOffs = 0;
+    
+    // Lay out every mip first so they can be decoded in any order
+    size_t mipCount = lastMip - firstMip + 1;
+    for (size_t m = 0; m < mipCount; m++) {
+        TXTRMipInfo_t *curMipInfo = &mipInfo[firstMip + m];
+        size_t curOutSz = (size_t) curMipInfo->width * curMipInfo->height;
+        mipsOut[m].width = curMipInfo->width;
+        mipsOut[m].height = curMipInfo->height;
         mipsOut[m].size = curOutSz;
-        mipsOut[m].data = malloc(dataSz);
+        if (chain) {
+            mipsOut[m].data = chain + chainOffs;
+            mipsOut[m].borrowed = m || chain == opts->outBuf;
+            chainOffs += curOutSz;
+        } else {
+            mipsOut[m].data = malloc(curOutSz * sizeof(uint32_t));
+            mipsOut[m].borrowed = false;
+        }
         if (!mipsOut[m].data) {
             free(palette);
             for (size_t m2 = 0, l2 = m + 1; m2 < l2; m2++)
                 TXTRMipmap_free(&mipsOut[m2]);
             return TXTR_DE_MEMFAILMIP;
         }
-        
-        size_t pixsrd = 0;
-        switch (txtr->hdr.format) {
-            case TXTR_TTF_I4:
-                pixsrd = GX_DecodeI4(mipWidth, mipHeight, mipsSzRem, mipsPtr, curOutSz, mipsOut[m].data, &gxOpts);
-                break;
-            case TXTR_TTF_I8:
-                pixsrd = GX_DecodeI8(mipWidth, mipHeight, mipsSzRem, mipsPtr, curOutSz, mipsOut[m].data, &gxOpts);
-                break;
-            case TXTR_TTF_IA4:
-                pixsrd = GX_DecodeIA4(mipWidth, mipHeight, mipsSzRem, mipsPtr, curOutSz, mipsOut[m].data, &gxOpts);
-                break;
-            case TXTR_TTF_IA8:
-                pixsrd = GX_DecodeIA8(mipWidth, mipHeight, mipsSzRem, mipsPtr, curOutSz, mipsOut[m].data, &gxOpts);
-                break;
-            case TXTR_TTF_CI4:
-                pixsrd = GX_DecodeCI4(mipWidth, mipHeight, mipsSzRem, mipsPtr, txtr->palSz, palette, curOutSz,
-                    mipsOut[m].data, &gxOpts);
-                break;
-            case TXTR_TTF_CI8:
-                pixsrd = GX_DecodeCI8(mipWidth, mipHeight, mipsSzRem, mipsPtr, txtr->palSz, palette, curOutSz,
-                    mipsOut[m].data, &gxOpts);
-                break;
-            case TXTR_TTF_CI14X2:
-                pixsrd = GX_DecodeCI14X2(mipWidth, mipHeight, mipsSzRem, mipsPtr, txtr->palSz, palette, curOutSz,
-                    mipsOut[m].data, &gxOpts);
-                break;
-            case TXTR_TTF_R5G6B5:
-                pixsrd = GX_DecodeR5G6B5(mipWidth, mipHeight, mipsSzRem, mipsPtr, curOutSz, mipsOut[m].data, &gxOpts);
-                break;
-            case TXTR_TTF_RGB5A3:
-                pixsrd = GX_DecodeRGB5A3(mipWidth, mipHeight, mipsSzRem, mipsPtr, curOutSz, mipsOut[m].data, &gxOpts);
-                break;
-            case TXTR_TTF_RGBA8:
-                pixsrd = GX_DecodeRGBA8(mipWidth, mipHeight, mipsSzRem, mipsPtr, curOutSz, mipsOut[m].data, &gxOpts);
-                break;
-            case TXTR_TTF_CMP:
-                pixsrd = GX_DecodeCMP(mipWidth, mipHeight, mipsSzRem, mipsPtr, curOutSz, mipsOut[m].data, &gxOpts);
-                break;
-            default:
-                free(palette);
-                for (size_t m2 = 0, l2 = m + 1; m2 < l2; m2++)
-                    TXTRMipmap_free(&mipsOut[m2]);
-                return TXTR_DE_INVLDTEXFMT;
-        }
-        
-        mipsSzRem -= pixsrd;
-        mipsPtr += pixsrd;
-        
-        mipWidth /= 2;
-        mipHeight /= 2;
     }
+    
+    // Seek straight to each mip instead of decoding the ones before it
+    // Largest mips come first so the smaller ones fill in around them
+    bool decFail = false;
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic, 1) reduction(||:decFail) if(opts->parallel)
+#endif
+    for (int32_t m = 0; m < (int32_t) mipCount; m++)
+        if (catexit_loopSafety)
+            decFail = TXTR_DecodeMip(txtr, &mipInfo[firstMip + m], palette, &mipsOut[m], &gxOpts) || decFail;
     free(palette);
     
+    if (decFail) {
+        for (size_t m = 0; m < mipCount; m++)
+            TXTRMipmap_free(&mipsOut[m]);
+        return TXTR_DE_INVLDTEXFMT;
+    }
+    
     if (!catexit_loopSafety) {
-        for (size_t m2 = 0, l2 = m + 1; m2 < l2; m2++)
-            TXTRMipmap_free(&mipsOut[m2]);
+        for (size_t m = 0; m < mipCount; m++)
+            TXTRMipmap_free(&mipsOut[m]);
         return TXTR_DE_INTERRUPTED;
     }
     
-    *mipsOutCount = m;
+    *mipsOutCount = mipCount;
     
     return TXTR_DE_SUCCESS;
 }
@@ -388,6 +629,18 @@ TXTR_EXPORT char *TXTRReadError_ToStr(TXTRReadError_t txtrReadError) {
             return "TXTR_RE_MEMFAILMIPS"
 #ifdef TXTR_INCLUDE_ERROR_STRINGS
                 ": Failed to allocate memory for input mipmap(s)."
+#endif
+            ;
+        case TXTR_RE_MAPFAILFILE:
+            return "TXTR_RE_MAPFAILFILE"
+#ifdef TXTR_INCLUDE_ERROR_STRINGS
+                ": Failed to open and map the file."
+#endif
+            ;
+        case TXTR_RE_INVLDDATASZ:
+            return "TXTR_RE_INVLDDATASZ"
+#ifdef TXTR_INCLUDE_ERROR_STRINGS
+                ": Invalid data size. The data ends before its headers, palette or mipmaps do."
 #endif
             ;
         default:
@@ -477,6 +730,18 @@ TXTR_EXPORT char *TXTRDecodeError_ToStr(TXTRDecodeError_t txtrDecodeError) {
             return "TXTR_DE_FAILDECPAL"
 #ifdef TXTR_INCLUDE_ERROR_STRINGS
                 ": Failed to decode palette."
+#endif
+            ;
+        case TXTR_DE_INVLDMIPRANGE:
+            return "TXTR_DE_INVLDMIPRANGE"
+#ifdef TXTR_INCLUDE_ERROR_STRINGS
+                ": Invalid mipmap range. The first and last mipmap must be below the mipmap count."
+#endif
+            ;
+        case TXTR_DE_INVLDOUTBUFSZ:
+            return "TXTR_DE_INVLDOUTBUFSZ"
+#ifdef TXTR_INCLUDE_ERROR_STRINGS
+                ": Invalid output buffer size. It must hold every mipmap to decode, see TXTR_CalcDecodeSz."
 #endif
             ;
         default:
@@ -501,6 +766,8 @@ TXTREncodeOptions_t *opts) {
     if (txtr) {
         txtr->pal = NULL;
         txtr->mips = NULL;
+        txtr->borrowed = false;
+        txtr->map = NULL;
     }
     
     if (!dataSz || !data || !txtr || !txtrMips || !opts)
@@ -533,6 +800,15 @@ TXTREncodeOptions_t *opts) {
     if (opts->ditherType < GX_DT_MIN || opts->ditherType > GX_DT_MAX)
         return TXTR_EE_INVLDGXDITHERTYPE;
     
+    if (opts->quantType < GX_QT_MIN || opts->quantType > GX_QT_MAX)
+        return TXTR_EE_INVLDGXQUANTTYPE;
+    
+    if (opts->kmeansThreshold < 0.0 || opts->kmeansTimeLimit < 0.0)
+        return TXTR_EE_INVLDKMEANSLIMITS;
+    
+    if (opts->octreeDepth > OCQ_MAX_DEPTH)
+        return TXTR_EE_INVLDOCTREEDEPTH;
+    
     if (opts->squishMetric && opts->squishMetricSz != 3)
         return TXTR_EE_INVLDSQUISHMETRICSZ;
     
@@ -562,6 +838,17 @@ TXTREncodeOptions_t *opts) {
         .flipY = opts->flipY,
         .avgType = opts->avgType,
         .ditherType = opts->ditherType,
+        .quantType = opts->quantType,
+        // TXTR and GX palette formats are declared in the same order
+        .palFmt = isIndexed ? (GXPaletteFormat_t) (GX_PF_IA8 + (palFmt - TXTR_TPF_IA8)) : GX_PF_RGBA8,
+        .sampleBudget = opts->sampleBudget,
+        .octreeLeafCap = opts->octreeLeafCap,
+        .octreeDepth = opts->octreeDepth,
+        .octree = opts->octree,
+        .octreeStats = opts->octreeStats,
+        .kmeansIters = opts->kmeansIters,
+        .kmeansThreshold = opts->kmeansThreshold,
+        .kmeansTimeLimit = opts->kmeansTimeLimit,
         .squishFlags = opts->squishFlags,
         .squishMetricSz = opts->squishMetricSz,
         .squishMetric = opts->squishMetric
@@ -978,6 +1265,24 @@ TXTR_EXPORT char *TXTREncodeError_ToStr(TXTREncodeError_t txtrEncodeError) {
             return "TXTR_EE_INVLDGXDITHERTYPE"
 #ifdef TXTR_INCLUDE_ERROR_STRINGS
                 ": Invalid GX dither tpye."
+#endif
+            ;
+        case TXTR_EE_INVLDGXQUANTTYPE:
+            return "TXTR_EE_INVLDGXQUANTTYPE"
+#ifdef TXTR_INCLUDE_ERROR_STRINGS
+                ": Invalid GX quantizer type."
+#endif
+            ;
+        case TXTR_EE_INVLDKMEANSLIMITS:
+            return "TXTR_EE_INVLDKMEANSLIMITS"
+#ifdef TXTR_INCLUDE_ERROR_STRINGS
+                ": Invalid k-means limits. The threshold and time limit must not be negative."
+#endif
+            ;
+        case TXTR_EE_INVLDOCTREEDEPTH:
+            return "TXTR_EE_INVLDOCTREEDEPTH"
+#ifdef TXTR_INCLUDE_ERROR_STRINGS
+                ": Invalid octree depth. It must not be greater than OCQ_MAX_DEPTH."
 #endif
             ;
         default: